@@ -0,0 +1,100 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "webrtc/api/video/i420_buffer.h"
+
+#include "packages/streamer/include/convert.h"
+#include "packages/streamer/include/worker_pool.h"
+
+DEFINE_int32(iterations, 200, "number of frames to convert for each case");
+DEFINE_int32(threads, 4, "number of workers for the parallel runs, or zero to skip them");
+
+namespace {
+
+struct Case {
+    int src_width;
+    int src_height;
+    int dst_width;
+    int dst_height;
+    streamer::PixelFormat format;
+    int depth;
+    const char* name;
+};
+
+// Get the mean time per call of FN in microseconds
+template <typename Fn> double TimeMicros(Fn fn) {
+    // warm up caches and the pooled scratch buffers
+    fn();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+        fn();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::micro>(elapsed).count() / FLAGS_iterations;
+}
+
+void RunCase(const Case& c, streamer::WorkerPool* workers) {
+    std::vector<uint8_t> pixels(c.src_width * c.src_height * c.depth);
+    std::mt19937 rng(0);
+    for (auto& p : pixels) {
+        p = rng();
+    }
+    const streamer::ImageView image{ pixels.data(), pixels.size(), c.src_width, c.src_height, c.format };
+    CHECK(streamer::CanConvertAndScale(image, c.dst_width, c.dst_height));
+
+    auto native = webrtc::I420Buffer::Create(c.src_width, c.src_height);
+    auto twoPass = webrtc::I420Buffer::Create(c.dst_width, c.dst_height);
+    auto fused = webrtc::I420Buffer::Create(c.dst_width, c.dst_height);
+
+    const double twoPassUs = TimeMicros([&] {
+        CHECK(streamer::ConvertImage(image, native));
+        CHECK(streamer::ScaleYUV(*native, twoPass));
+    });
+    const double fusedUs = TimeMicros([&] { CHECK(streamer::ConvertAndScaleImage(image, fused)); });
+
+    LOG(INFO) << c.name << " " << c.src_width << "x" << c.src_height << " -> " << c.dst_width << "x" << c.dst_height
+              << ": two-pass " << twoPassUs << "us, fused " << fusedUs << "us (" << twoPassUs / fusedUs << "x)";
+
+    if (workers) {
+        const double parallelUs = TimeMicros([&] { CHECK(streamer::ConvertAndScaleImage(image, fused, workers)); });
+        const double parallelNativeUs = TimeMicros([&] { CHECK(streamer::ConvertImage(image, native, workers)); });
+        LOG(INFO) << c.name << " on " << workers->size() << " workers: fused " << parallelUs << "us (" << fusedUs / parallelUs
+                  << "x), native " << parallelNativeUs << "us";
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    gflags::SetUsageMessage("Compare two-pass and fused conversion to I420");
+    gflags::SetVersionString("0.0.1");
+    gflags::ParseCommandLineFlags(&argc, &argv, false);
+
+    FLAGS_logtostderr = true;
+
+    const std::vector<Case> cases = {
+        { 1280, 720, 640, 360, streamer::PixelFormat::RGBA, 4, "rgba" },
+        { 1280, 720, 640, 360, streamer::PixelFormat::RGB, 3, "rgb" },
+        { 1280, 720, 640, 360, streamer::PixelFormat::Gray, 1, "luminance" },
+        { 4096, 1024, 1024, 256, streamer::PixelFormat::RGBA, 4, "rgba panorama" },
+        { 4096, 1024, 1024, 256, streamer::PixelFormat::RGB, 3, "rgb panorama" },
+        { 5760, 1080, 1920, 360, streamer::PixelFormat::RGBA, 4, "rgba triple panorama" },
+    };
+    std::unique_ptr<streamer::WorkerPool> workers;
+    if (FLAGS_threads > 0) {
+        workers.reset(new streamer::WorkerPool(FLAGS_threads));
+    }
+    for (const Case& c : cases) {
+        RunCase(c, workers.get());
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "webrtc/common_video/h264/h264_common.h"
+
+#include "packages/filesystem/include/filesystem.h"
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/raw_sample.h"
+
+DEFINE_string(input, "", "H.264 elementary stream in Annex B format to publish");
+DEFINE_string(camera_addr, "tcp://*:5556", "ZMQ socket for camera publisher");
+DEFINE_string(camera_topic, "camera", "topic for camera publisher");
+DEFINE_string(keyframe_addr, "tcp://*:5557", "ZMQ socket on which keyframe requests are pulled");
+DEFINE_int32(image_width, 1280, "width of the encoded images");
+DEFINE_int32(image_height, 720, "height of the encoded images");
+DEFINE_int32(fps, 30, "access units to publish per second");
+
+namespace {
+
+struct AccessUnit {
+    size_t offset;
+    size_t size;
+    bool keyframe;
+};
+
+// Split an elementary stream into access units, assuming one slice per
+// picture, which is what camera encoders produce
+std::vector<AccessUnit> SplitAccessUnits(const std::string& stream) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(stream.data());
+    std::vector<AccessUnit> units;
+    bool hasSlice = false;
+    for (const auto& nalu : webrtc::H264::FindNaluIndices(data, stream.size())) {
+        if (nalu.payload_size == 0) {
+            continue;
+        }
+        const auto type = webrtc::H264::ParseNaluType(data[nalu.payload_start_offset]);
+        const bool slice = type == webrtc::H264::kSlice || type == webrtc::H264::kIdr;
+
+        // A parameter set, SEI or delimiter after a slice starts a new picture
+        if (units.empty() || (hasSlice && !slice)) {
+            units.push_back(AccessUnit{ nalu.start_offset, 0, false });
+            hasSlice = false;
+        } else if (hasSlice && slice) {
+            units.push_back(AccessUnit{ nalu.start_offset, 0, false });
+        }
+
+        AccessUnit& unit = units.back();
+        unit.size = nalu.payload_start_offset + nalu.payload_size - unit.offset;
+        unit.keyframe |= type == webrtc::H264::kIdr;
+        hasSlice |= slice;
+    }
+    return units;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    gflags::SetUsageMessage("Publish a pre-encoded H.264 stream over ZMQ, as a camera with a hardware encoder would");
+    gflags::SetVersionString("0.0.1");
+    gflags::ParseCommandLineFlags(&argc, &argv, false);
+
+    FLAGS_logtostderr = true;
+
+    CHECK(!FLAGS_input.empty()) << "--input is required";
+    const std::string stream = filesystem::readFileToString(FLAGS_input);
+    const auto units = SplitAccessUnits(stream);
+    CHECK(!units.empty()) << "no access units in " << FLAGS_input;
+    LOG(INFO) << "loaded " << units.size() << " access units from " << FLAGS_input;
+
+    zmq::context_t context(1);
+    zmq::socket_t pub(context, ZMQ_PUB);
+    pub.setsockopt(ZMQ_SNDHWM, 64);
+    pub.setsockopt(ZMQ_LINGER, 0);
+    pub.bind(FLAGS_camera_addr);
+
+    zmq::socket_t keyframes(context, ZMQ_PULL);
+    keyframes.setsockopt(ZMQ_LINGER, 0);
+    keyframes.bind(FLAGS_keyframe_addr);
+    LOG(INFO) << "publishing on " << FLAGS_camera_addr << ", topic:" << FLAGS_camera_topic << ", keyframe requests on "
+              << FLAGS_keyframe_addr;
+
+    hal::CameraSample sample;
+    sample.mutable_image()->set_rows(FLAGS_image_height);
+    sample.mutable_image()->set_cols(FLAGS_image_width);
+
+    const auto interval = std::chrono::microseconds(1000000 / FLAGS_fps);
+    uint64_t sequence = 0;
+    size_t next = 0;
+    while (true) {
+        // A real encoder would produce an IDR frame on request. The nearest
+        // thing we can do is skip ahead to the next one in the file.
+        zmq::message_t request;
+        bool skip = false;
+        while (keyframes.recv(&request, ZMQ_DONTWAIT)) {
+            LOG(INFO) << "keyframe requested for " << std::string(static_cast<const char*>(request.data()), request.size());
+            skip = true;
+        }
+        while (skip && !units[next].keyframe) {
+            next = (next + 1) % units.size();
+        }
+
+        const AccessUnit& unit = units[next];
+        const auto now = std::chrono::system_clock::now().time_since_epoch();
+        sample.set_id(sequence++);
+        sample.mutable_systemtimestamp()->set_nanos(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+        streamer::SendSample(pub, FLAGS_camera_topic, sample, stream.data() + unit.offset, unit.size);
+
+        // Loop back to the start of the file, which any well formed stream
+        // begins with a keyframe
+        next = (next + 1) % units.size();
+        std::this_thread::sleep_for(interval);
+    }
+
+    return 0;
+}
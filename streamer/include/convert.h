@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/api/video/video_frame_buffer.h"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/proto/stream.pb.h"
+
+namespace streamer {
+
+// forward declarations
+class WorkerPool;
+
+/// PixelFormat is the memory layout of a camera image
+enum class PixelFormat {
+    Unknown,
+    Gray,
+    RGB,
+    RGBA,
+    I420,
+    NV12,
+    YUYV,
+    JPEG,
+    H264,
+};
+
+/// ImageView describes packed pixels that live in memory owned by someone
+/// else, such as the ZMQ message they arrived in
+struct ImageView {
+    /// Pointer to the first pixel
+    const uint8_t* data;
+
+    /// Size of the pixel data in bytes
+    size_t size;
+
+    /// Width of the image in pixels
+    int width;
+
+    /// Height of the image in pixels
+    int height;
+
+    /// Pixel format of the image
+    PixelFormat format;
+};
+
+/// Get the layout of images with the given format published on a stream
+/// with the given input format. Returns PixelFormat::Unknown if the layout
+/// cannot be converted to I420.
+PixelFormat PixelFormatFor(hal::Format format, Stream::InputFormat input_format);
+
+/// Get the number of bytes in an image of the given format and size, or zero
+/// if the size depends on the content
+size_t ImageSize(PixelFormat format, int width, int height);
+
+/// Convert an uncompressed image to I420 at its native size. OUT must have
+/// the same dimensions as the input. If WORKERS is given, horizontal bands of
+/// the image are converted in parallel.
+bool ConvertImage(const ImageView& in, webrtc::I420Buffer* out, WorkerPool* workers = nullptr);
+
+/// Wrap an I420 image as a frame buffer without copying the pixels. OWNER
+/// is kept alive until the last reference to the buffer is dropped, and must
+/// keep the pixels valid until then.
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> WrapI420Image(const ImageView& in, std::shared_ptr<void> owner);
+
+/// Returns true if ConvertAndScaleImage can produce an image of the given
+/// size, which is the case for packed RGB and gray images when the input is a
+/// whole multiple of the output size in each direction
+bool CanConvertAndScale(const ImageView& in, int width, int height);
+
+/// Convert an image to I420 and downsample it to the size of OUT in a single
+/// pass. The image is processed in strips of a few rows that fit in cache,
+/// so no full-resolution intermediate is ever written. If WORKERS is given,
+/// horizontal bands of the image are processed in parallel.
+bool ConvertAndScaleImage(const ImageView& in, webrtc::I420Buffer* out, WorkerPool* workers = nullptr);
+
+/// Rescale an I420 image to the size of OUT
+bool ScaleYUV(const webrtc::VideoFrameBuffer& in, webrtc::I420Buffer* out);
+
+} // namespace streamer
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "zmq.hpp"
+
+#include "webrtc/base/refcount.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+
+namespace streamer {
+
+/// KeyframeRequester asks whoever encodes a stream for a keyframe on behalf
+/// of the receivers of that stream. Requests from every receiver go through
+/// the same requester, which passes on at most one per minimum interval and
+/// merges the rest into it, so that a burst of viewers joining or losing
+/// packets at the same time costs a single keyframe.
+class KeyframeRequester {
+public:
+    /// Pass on at most one request per MIN_INTERVAL
+    explicit KeyframeRequester(std::chrono::milliseconds min_interval);
+
+    virtual ~KeyframeRequester() = default;
+
+    KeyframeRequester(const KeyframeRequester&) = delete;
+    KeyframeRequester& operator=(const KeyframeRequester&) = delete;
+
+    /// Ask for a keyframe. Never blocks. Safe to call from any thread.
+    void Request();
+
+    /// Get the number of requests passed on
+    inline uint64_t count() const { return m_count; }
+
+    /// Get the number of requests merged into one passed on shortly before
+    inline uint64_t merged_count() const { return m_merged; }
+
+protected:
+    /// Pass a request on to the encoder. Returns false if the request was
+    /// dropped. Called with the requester's mutex held.
+    virtual bool Send() = 0;
+
+private:
+    /// Minimum time between requests passed on
+    std::chrono::milliseconds m_min_interval;
+
+    /// Time at which a request was last passed on, in milliseconds on the
+    /// rtc::TimeMillis clock
+    int64_t m_last_ms;
+
+    /// Number of requests passed on
+    std::atomic<uint64_t> m_count;
+
+    /// Number of requests merged into an earlier one
+    std::atomic<uint64_t> m_merged;
+
+    /// The mutex serializing requests
+    std::mutex m_guard;
+};
+
+/// ZmqKeyframeRequester asks the publisher of an encoded stream for a
+/// keyframe over a ZMQ side channel. Each request is a single frame containing
+/// the topic of the stream, pushed to the address given in the stream options.
+class ZmqKeyframeRequester : public KeyframeRequester {
+public:
+    /// Connect to the publisher's keyframe request address
+    ZmqKeyframeRequester(zmq::context_t* ctx, const std::string& address, const std::string& topic, std::chrono::milliseconds min_interval);
+
+protected:
+    /// Push the request without waiting. The request is dropped if the
+    /// publisher is not keeping up.
+    bool Send() override;
+
+private:
+    /// The topic of the stream
+    std::string m_topic;
+
+    /// The socket on which requests are pushed
+    zmq::socket_t m_socket;
+};
+
+/// EncodedFrameBuffer is a native frame buffer that carries one encoded frame
+/// to the passthrough encoder, either an H.264 access unit in Annex B format
+/// from the camera or a frame encoded once by a SharedEncoder for every
+/// session watching it. The pixels are never decoded, so the I420 accessors
+/// must not be used.
+class EncodedFrameBuffer : public webrtc::NativeHandleBuffer {
+public:
+    /// Wrap an encoded frame of the given size. INFO describes the codec
+    /// and is handed to the packetizer with the frame. OWNER is kept alive
+    /// until the last reference to the buffer is dropped, and must keep the
+    /// data valid until then. SEQUENCE increases by one for each frame
+    /// encoded, so that receivers can tell when one was skipped.
+    EncodedFrameBuffer(const uint8_t* data,
+        size_t size,
+        int width,
+        int height,
+        const webrtc::CodecSpecificInfo& info,
+        bool keyframe,
+        uint64_t sequence,
+        std::shared_ptr<void> owner,
+        std::shared_ptr<KeyframeRequester> keyframes);
+
+    /// Get the encoded bytes
+    inline const uint8_t* data() const { return m_data; }
+
+    /// Get the number of encoded bytes
+    inline size_t size() const { return m_size; }
+
+    /// Get the codec of the frame and the details the packetizer needs
+    inline const webrtc::CodecSpecificInfo& info() const { return m_info; }
+
+    /// Get the position of this frame in the stream
+    inline uint64_t sequence() const { return m_sequence; }
+
+    /// Returns true if the frame can be decoded without the ones before it
+    inline bool keyframe() const { return m_keyframe; }
+
+    /// Ask the encoder for a keyframe, if it offers a way to do that
+    void RequestKeyframe();
+
+    /// Wrap the same encoded bytes in a buffer of its own, which is passed
+    /// through just like this one. RELEASED, if set, is called once the
+    /// last reference to the new buffer is dropped.
+    rtc::scoped_refptr<EncodedFrameBuffer> Alias(std::function<void()> released = nullptr) const;
+
+    /// Returns null. Encoded frames can only be passed through.
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> NativeToI420Buffer() override;
+
+    /// Get the encoded buffer inside a frame buffer, or null if it is not one
+    static EncodedFrameBuffer* From(const webrtc::VideoFrameBuffer& buffer);
+
+    /// Returns true if the H.264 access unit contains an IDR slice
+    static bool IsH264Keyframe(const uint8_t* data, size_t size);
+
+private:
+    /// The encoded bytes
+    const uint8_t* m_data;
+
+    /// The number of encoded bytes
+    size_t m_size;
+
+    /// The codec of the frame and the details the packetizer needs
+    webrtc::CodecSpecificInfo m_info;
+
+    /// The position of this frame in the stream
+    uint64_t m_sequence;
+
+    /// Whether the frame can be decoded without the ones before it
+    bool m_keyframe;
+
+    /// Keeps the encoded bytes alive
+    std::shared_ptr<void> m_owner;
+
+    /// Where keyframes are requested, or null if they cannot be
+    std::shared_ptr<KeyframeRequester> m_keyframes;
+};
+
+} // namespace streamer
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "webrtc/media/base/codec.h"
+#include "webrtc/media/engine/webrtcvideoencoderfactory.h"
+#include "webrtc/video_encoder.h"
+
+#include "packages/streamer/proto/signaler_options.pb.h"
+
+namespace streamer {
+
+/// EncoderFactory provides the video encoders for every session, tuned as
+/// given in the encoder options and with the keyframe interval given in the
+/// loss resilience options.
+///
+/// H.264 is always offered, for passing through camera streams that are
+/// already encoded, and so is VP8, for passing through frames from a
+/// SharedEncoder. Both are encoded by PassthroughEncoder, which hands raw
+/// frames to a software encoder if the codec is also preferred for raw
+/// video. VP9 is only offered if it is preferred. Sessions with raw sources
+/// must restrict their offer to RawCodecNames.
+///
+/// Every encoder made here tells the FrameWatch of its session when it
+/// encodes a frame after being fed one that the session watched.
+class EncoderFactory : public cricket::WebRtcVideoEncoderFactory {
+public:
+    EncoderFactory(const EncoderOptions& opts, const LossResilienceOptions& resilience);
+
+    EncoderFactory(const EncoderFactory&) = delete;
+    EncoderFactory& operator=(const EncoderFactory&) = delete;
+
+    // cricket::WebRtcVideoEncoderFactory implementation
+    webrtc::VideoEncoder* CreateVideoEncoder(const cricket::VideoCodec& codec) override;
+    const std::vector<cricket::VideoCodec>& supported_codecs() const override;
+    void DestroyVideoEncoder(webrtc::VideoEncoder* encoder) override;
+
+    /// Get the names of the codecs to offer for raw video, in order of
+    /// preference, leaving out any that this build cannot encode
+    static std::vector<std::string> RawCodecNames(const EncoderOptions& opts);
+
+private:
+    /// Create a software encoder for raw frames in the given codec, tuned as
+    /// given in the options, or null if raw frames are not to be encoded in it
+    webrtc::VideoEncoder* CreateSoftwareEncoder(const cricket::VideoCodec& codec);
+
+    /// Options for the encoders
+    EncoderOptions m_opts;
+
+    /// Options for surviving packet loss, with the preset applied
+    LossResilienceOptions m_resilience;
+
+    /// The names of the codecs to offer for raw video
+    std::vector<std::string> m_raw_codecs;
+
+    /// The codecs we can encode
+    std::vector<cricket::VideoCodec> m_codecs;
+};
+
+} // namespace streamer
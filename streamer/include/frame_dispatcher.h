@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "packages/streamer/include/worker_pool.h"
+
+namespace streamer {
+
+// forward declarations
+class FrameSource;
+
+/// FrameDispatcher waits for frames on the sockets of every active source
+/// from a single reactor thread and hands each ready source to a fixed pool
+/// of workers for receiving and conversion. A source is never processed by
+/// more than one worker at a time, and its socket is not polled while a
+/// worker is busy with it.
+class FrameDispatcher {
+public:
+    /// Start the reactor thread and NUM_WORKERS workers, or one worker per
+    /// core if zero
+    FrameDispatcher(size_t num_workers);
+
+    /// Stops the reactor thread and the workers
+    ~FrameDispatcher();
+
+    FrameDispatcher(const FrameDispatcher&) = delete;
+    FrameDispatcher& operator=(const FrameDispatcher&) = delete;
+
+    /// Start polling the socket of the given source
+    void Add(FrameSource* source);
+
+    /// Stop polling the socket of the given source. When this returns, no
+    /// worker is processing the source and the reactor no longer touches its
+    /// socket, so the source can safely be destroyed.
+    void Remove(FrameSource* source);
+
+    /// Get the workers, which are also available for other capture work
+    inline WorkerPool* workers() { return &m_workers; }
+
+private:
+    /// A source registered with the reactor
+    struct Entry {
+        /// The source
+        FrameSource* source;
+
+        /// Whether a worker is currently processing the source
+        bool busy;
+    };
+
+    /// The loop that runs on the reactor thread
+    void Loop();
+
+    /// Process the source on a worker and then make it pollable again
+    void Process(FrameSource* source);
+
+    /// Interrupt the reactor so that it rebuilds its poll set
+    void Wake();
+
+    /// Registered sources
+    std::vector<Entry> m_entries;
+
+    /// Number of times the reactor has returned from polling
+    uint64_t m_cycles;
+
+    /// Whether the reactor is currently polling
+    bool m_polling;
+
+    /// The signal used to stop the reactor
+    bool m_should_continue;
+
+    /// The mutex protecting access to the fields above
+    std::mutex m_guard;
+
+    /// Signalled when a source finishes processing or the reactor finishes polling
+    std::condition_variable m_changed;
+
+    /// Pipe used to interrupt the reactor (read end, write end)
+    int m_wake_fds[2];
+
+    /// The workers that receive and convert frames
+    WorkerPool m_workers;
+
+    /// The reactor thread
+    std::thread m_thread;
+};
+
+} // namespace streamer
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/base/refcount.h"
+
+namespace streamer {
+
+/// FramePool hands out I420 buffers and takes them back once every holder,
+/// including the encoder, has dropped its reference. Buffers of every size
+/// that is in use stay in the pool, so switching between output sizes does
+/// not cause any allocation in steady state. The pool never owns more than
+/// its capacity: when it is full, a free buffer of another size is evicted,
+/// least recently used first, and when every pooled buffer is in use the
+/// buffer handed out is not pooled at all.
+class FramePool {
+public:
+    /// Counters describing how well the pool is working
+    struct Stats {
+        /// Number of requests served by a free pooled buffer
+        uint64_t hits;
+
+        /// Number of requests that required a new allocation
+        uint64_t misses;
+
+        /// Number of misses served by a buffer the pool did not keep,
+        /// because every pooled buffer was in use
+        uint64_t unpooled;
+
+        /// Number of free buffers dropped to make room for another size
+        uint64_t evictions;
+
+        /// Number of buffers currently owned by the pool
+        size_t size;
+
+        /// Largest number of buffers simultaneously in use
+        size_t high_water;
+    };
+
+    /// Construct a pool that owns at most CAPACITY buffers. The label is used
+    /// for logging only.
+    FramePool(const std::string& label, size_t capacity = 16);
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /// Get a buffer of the given size that nobody else holds a reference to
+    rtc::scoped_refptr<webrtc::I420Buffer> CreateBuffer(int width, int height);
+
+    /// Get a snapshot of the pool counters
+    Stats stats();
+
+private:
+    typedef rtc::RefCountedObject<webrtc::I420Buffer> PooledBuffer;
+
+    /// The label for this pool (used for logging only)
+    std::string m_label;
+
+    /// Maximum number of buffers to own
+    size_t m_capacity;
+
+    /// All buffers owned by the pool, whether in use or not, least recently
+    /// handed out first
+    std::list<rtc::scoped_refptr<PooledBuffer> > m_buffers;
+
+    /// The pool counters
+    Stats m_stats;
+
+    /// The mutex protecting access to m_buffers and m_stats
+    std::mutex m_guard;
+};
+
+/// Print pool counters in a form suitable for logging
+std::ostream& operator<<(std::ostream& out, const FramePool::Stats& stats);
+
+} // namespace streamer
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "zmq.hpp"
+
+#include "webrtc/api/video/video_frame_buffer.h"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/frame_dispatcher.h"
+#include "packages/streamer/include/frame_pool.h"
+#include "packages/streamer/include/jpeg_decoder.h"
+#include "packages/streamer/include/latency.h"
+#include "packages/streamer/include/raw_sample.h"
+#include "packages/streamer/proto/stream.pb.h"
+
+namespace streamer {
+
+// forward declarations
+class KeyframeRequester;
+class SharedEncoder;
+struct ScaleCache;
+
+/// Frame is a camera sample that is converted to I420 on demand. A single
+/// Frame is shared read-only by every sink attached to the FrameSource that
+/// produced it, and is only valid for the duration of FrameSink::OnSourceFrame.
+struct Frame {
+    /// Get this frame converted and rescaled to the given size. Each distinct
+    /// size is produced at most once per frame and the result is shared
+    /// between all callers, so the returned buffer must not be modified.
+    /// Whole-number downscales are converted and scaled in a single pass, and
+    /// I420 samples at their native size are passed on without copying.
+    /// Encoded samples and frames encoded by a SharedEncoder are returned as
+    /// an EncodedFrameBuffer at their own size, whatever size is asked for.
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> Scaled(int width, int height) const;
+
+    /// Get the given rectangle of this frame, in camera image coordinates,
+    /// converted and rescaled to the given size. This is the same as Scaled
+    /// if the rectangle covers the whole image. Otherwise the result is made
+    /// for this caller only. Encoded frames cannot be cropped and are
+    /// returned as Scaled returns them.
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> Cropped(int crop_x, int crop_y, int crop_width, int crop_height, int width, int height) const;
+
+    /// Width of the camera image in pixels
+    int width;
+
+    /// Height of the camera image in pixels
+    int height;
+
+    /// Time at which the frame was captured, in microseconds on the
+    /// rtc::TimeMicros clock. This is the conversion time if the sample did
+    /// not carry a capture timestamp.
+    int64_t timestamp_us;
+
+    /// Time at which the frame was captured in nanoseconds since the unix
+    /// epoch, or zero if the sample did not carry a capture timestamp
+    int64_t capture_time_ns;
+
+    /// The raw pixels and the converted copies made from them so far, or null
+    /// for frames encoded by a SharedEncoder
+    std::shared_ptr<ScaleCache> scaled;
+
+    /// The frame encoded by a SharedEncoder, or null for camera samples
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> encoded;
+};
+
+/// FrameSink receives converted frames from a FrameSource
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    /// Called on a dispatcher worker before a sample is dispatched. Returns
+    /// false if the sink would drop a frame of the given input size and
+    /// capture time. Samples that no sink wants are never converted.
+    virtual bool WantsFrame(int width, int height, int64_t timestamp_us) = 0;
+
+    /// Called on a dispatcher worker for every frame that the sink wanted.
+    /// Implementations must not modify the frame buffer, and must not hold on
+    /// to the frame after returning.
+    virtual void OnSourceFrame(const Frame& frame) = 0;
+};
+
+/// FrameSource subscribes to one ZMQ address and topic and converts each
+/// camera sample to I420 at most once per output size, no matter how many
+/// sinks are attached.
+/// Frames are received and converted on the workers of a FrameDispatcher.
+class FrameSource {
+public:
+    /// Subscribe to the address and topic in the given stream and register
+    /// with the dispatcher. This can block on at least one TCP roundtrip.
+    FrameSource(const Stream& stream, zmq::context_t* ctx, FrameDispatcher* dispatcher);
+
+    /// Unregisters from the dispatcher and closes the socket
+    ~FrameSource();
+
+    FrameSource(const FrameSource&) = delete;
+    FrameSource& operator=(const FrameSource&) = delete;
+
+    /// Start delivering frames to the given sink
+    void AddSink(FrameSink* sink);
+
+    /// Stop delivering frames to the given sink. No calls to the sink will be
+    /// made after this returns.
+    void RemoveSink(FrameSink* sink);
+
+    /// Get the shared encoder for the largest tier that fits within the given
+    /// output size, or the smallest tier if none fits, or the largest tier if
+    /// the size is zero. Returns null if the source is not shared. The
+    /// encoder lives as long as the source.
+    SharedEncoder* SharedEncoderFor(int output_width, int output_height);
+
+    /// Get the key that identifies this source in the registry
+    inline const std::string& key() const { return m_key; }
+
+    /// Get the counters for the buffer pool shared by all frames of this source
+    inline FramePool::Stats pool_stats() { return m_pool->stats(); }
+
+    /// Get the number of samples discarded because a newer one was queued
+    inline uint64_t superseded_count() const { return m_superseded; }
+
+    /// Get the number of samples dropped for exceeding the age budget
+    inline uint64_t stale_count() const { return m_stale; }
+
+    /// Get the number of samples that no sink wanted
+    inline uint64_t unwanted_count() const { return m_unwanted; }
+
+    /// Print latency histograms and counters for this source
+    void PrintStats(std::ostream& out);
+
+    /// Get the address and topic of a stream, which label its source
+    static std::string KeyFor(const Stream& stream);
+
+private:
+    friend class FrameDispatcher;
+
+    /// Receive and dispatch a single frame. Called on a dispatcher
+    /// worker when the socket is readable.
+    void NextFrame();
+
+    /// The registry key for this source
+    std::string m_key;
+
+    /// Whether to skip to the newest queued sample before converting
+    bool m_conflate;
+
+    /// Maximum age of a sample before it is dropped, or zero for no limit
+    std::chrono::milliseconds m_max_age;
+
+    /// Minimum number of pixels in an image before it is converted in
+    /// parallel, or zero to always convert on a single thread
+    int64_t m_parallel_min_pixels;
+
+    /// Pixel layout of the samples, if not described by the sample itself
+    Stream::InputFormat m_input_format;
+
+    /// Number of samples discarded because a newer one was queued
+    std::atomic<uint64_t> m_superseded;
+
+    /// Number of samples dropped for exceeding the age budget
+    std::atomic<uint64_t> m_stale;
+
+    /// Number of samples that no sink wanted
+    std::atomic<uint64_t> m_unwanted;
+
+    /// Latency of each stage of the capture pipeline
+    struct {
+        /// Time from capture until the sample was received
+        LatencyHistogram receive;
+
+        /// Time spent receiving and parsing the sample
+        LatencyHistogram parse;
+
+        /// Time spent converting the sample to I420 at its native size
+        LatencyHistogram convert;
+
+        /// Time spent scaling a converted frame, once per distinct output size
+        LatencyHistogram scale;
+
+        /// Time spent converting and downscaling in a single pass, once per
+        /// distinct output size
+        LatencyHistogram fused;
+
+        /// Time spent decoding compressed samples, once per DCT scale
+        LatencyHistogram decode;
+
+        /// Time spent handing the frame to every sink
+        LatencyHistogram dispatch;
+    } m_latency;
+
+    /// The socket from which we read frames
+    zmq::socket_t m_socket;
+
+    /// Buffer for storing incoming samples, whose pixels stay in the ZMQ message
+    RawSample m_sample;
+
+    /// Pool from which converted frame buffers are drawn
+    std::shared_ptr<FramePool> m_pool;
+
+    /// Decoder for compressed samples, reused from frame to frame
+    JpegDecoder m_jpeg;
+
+    /// Side channel for asking the publisher of an encoded stream for a
+    /// keyframe, or null if there is none
+    std::shared_ptr<KeyframeRequester> m_keyframes;
+
+    /// One encoder per tier if the source is shared, ordered from the
+    /// smallest tier to the largest. These are also in m_sinks.
+    std::vector<std::unique_ptr<SharedEncoder> > m_shared_encoders;
+
+    /// The sinks to which frames are dispatched
+    std::vector<FrameSink*> m_sinks;
+
+    /// The sinks that want the frame currently being dispatched
+    std::vector<FrameSink*> m_wanted;
+
+    /// The mutex protecting access to m_sinks and m_wanted. It is held from
+    /// asking sinks whether they want a frame until the frame is dispatched.
+    std::mutex m_sink_guard;
+
+    /// The dispatcher that polls our socket
+    FrameDispatcher* m_dispatcher;
+};
+
+/// FrameSourceRegistry hands out one shared FrameSource per address, topic
+/// and set of source options, so a stream that asks for a topic with, say, a
+/// different age budget gets a source of its own rather than the first one.
+/// A source is torn down when the last session holding it lets go.
+class FrameSourceRegistry {
+public:
+    /// Construct a registry whose sources are converted on NUM_WORKERS
+    /// threads, or one thread per core if zero
+    FrameSourceRegistry(zmq::context_t* ctx, size_t num_workers);
+
+    /// Get the source for the given stream, creating it if necessary. The
+    /// source is created outside the registry lock, since it connects.
+    std::shared_ptr<FrameSource> Acquire(const Stream& stream);
+
+    /// Print latency histograms and counters for every live source
+    void PrintStats(std::ostream& out);
+
+private:
+    /// The zmq context for camera sample sockets
+    zmq::context_t* m_ctx;
+
+    /// The reactor and workers shared by all sources
+    FrameDispatcher m_dispatcher;
+
+    /// Map from the stream's source options to source. Entries expire when
+    /// the source does.
+    std::map<std::string, std::weak_ptr<FrameSource> > m_sources;
+
+    /// The mutex protecting access to m_sources
+    std::mutex m_guard;
+};
+
+} // namespace streamer
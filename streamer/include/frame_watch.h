@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "webrtc/base/scoped_ref_ptr.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+
+namespace streamer {
+
+/// FrameWatch tells a session when its encoder has encoded one of the frames
+/// it watched. Webrtc creates an encoder for each session without saying for
+/// which, so the session hands webrtc buffers that it alone holds, and the
+/// encoder finds the watch of the first such buffer it is fed and keeps it
+/// from then on. Finding a watch takes a process-wide lock, but only while
+/// some session is watching frames and only for encoders that have not found
+/// theirs yet. Everything else locks this watch alone.
+class FrameWatch : public std::enable_shared_from_this<FrameWatch> {
+public:
+    /// Handler called on an encoder thread once a watched frame is encoded
+    typedef std::function<void()> EncodedHandler;
+
+    explicit FrameWatch(EncodedHandler handler);
+    ~FrameWatch();
+
+    FrameWatch(const FrameWatch&) = delete;
+    FrameWatch& operator=(const FrameWatch&) = delete;
+
+    /// Get a buffer with the same contents that nobody else holds, without
+    /// copying the pixels or the encoded bytes, and watch it until it is
+    /// released
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> Watch(const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer);
+
+    /// Forget the frames watched so far, so that only frames watched from
+    /// now on count
+    void Reset();
+
+    /// Stop calling the handler, waiting for a call in progress to return
+    void Detach();
+
+    /// Called by an encoder for every frame it is fed
+    void Fed(const webrtc::VideoFrameBuffer* buffer);
+
+    /// Called by an encoder for every frame it encodes. Calls the handler if
+    /// a watched frame was fed to the encoder since the last reset.
+    void Encoded();
+
+    /// Get the watch of a buffer, or null if it is not watched
+    static std::shared_ptr<FrameWatch> Find(const webrtc::VideoFrameBuffer* buffer);
+
+private:
+    /// Stop watching a buffer that has been released
+    void Released(const webrtc::VideoFrameBuffer* buffer);
+
+    /// Called once a watched frame is encoded
+    EncodedHandler m_handler;
+
+    /// The watched buffers that are still alive
+    std::set<const webrtc::VideoFrameBuffer*> m_watched;
+
+    /// Whether a watched frame has been fed to the encoder
+    bool m_fed;
+
+    /// Whether any frame is watched, checked before taking the lock
+    std::atomic<bool> m_armed;
+
+    /// The mutex protecting access to m_handler, m_watched and m_fed
+    std::mutex m_guard;
+};
+
+} // namespace streamer
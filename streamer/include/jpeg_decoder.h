@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "webrtc/api/video/i420_buffer.h"
+
+#include "packages/streamer/include/frame_pool.h"
+
+// forward declarations
+struct jpeg_decompress_struct;
+
+namespace streamer {
+
+// forward declarations
+struct JpegErrorManager;
+
+/// JpegDecoder decodes JPEG images straight to I420. Images with 4:2:0
+/// chroma subsampling, which is what cameras produce, are decoded as raw
+/// planes with no color conversion at all. Downscaling by 2, 4 or 8 happens
+/// in the DCT domain, so the full resolution image is never reconstructed.
+///
+/// A decoder keeps its libjpeg state and scratch buffers between images, and
+/// must not be used from more than one thread at a time.
+class JpegDecoder {
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    JpegDecoder(const JpegDecoder&) = delete;
+    JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+    /// Read the dimensions of a JPEG image from its header
+    bool ReadSize(const uint8_t* data, size_t size, int* width, int* height);
+
+    /// Decode a JPEG image into a buffer drawn from the pool, shrinking it by
+    /// SCALE_DENOM (which must be 1, 2, 4 or 8) in each direction. The
+    /// output is rounded up to whole pixels.
+    rtc::scoped_refptr<webrtc::I420Buffer> Decode(const uint8_t* data, size_t size, int scale_denom, FramePool* pool);
+
+    /// Get the largest DCT scale denominator that decodes an image of the
+    /// source size to at least the destination size
+    static int ScaleDenom(int src_width, int src_height, int dst_width, int dst_height);
+
+private:
+    /// The layout of the decoded image in the scratch planes
+    enum class Layout {
+        Planar420,
+        Gray,
+        RGB,
+    };
+
+    /// Decode into the scratch planes. Must not create any object with a
+    /// destructor, since libjpeg reports errors with longjmp.
+    bool DecodeToScratch(const uint8_t* data, size_t size, int scale_denom);
+
+    /// The libjpeg error handler, which jumps back out of the decoder
+    std::unique_ptr<JpegErrorManager> m_error;
+
+    /// The libjpeg decompressor, reused for every image
+    std::unique_ptr<jpeg_decompress_struct> m_cinfo;
+
+    /// The decoded planes, padded out to whole blocks
+    std::vector<uint8_t> m_planes[3];
+
+    /// The row strides of the planes above
+    int m_strides[3];
+
+    /// The layout of the planes above
+    Layout m_layout;
+
+    /// The size of the most recently decoded image
+    int m_width;
+    int m_height;
+};
+
+} // namespace streamer
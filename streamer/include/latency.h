@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace streamer {
+
+/// LatencyHistogram accumulates durations into power-of-two microsecond
+/// buckets. Recording is lock-free and safe to call from any thread.
+class LatencyHistogram {
+public:
+    /// Bucket zero holds durations under 1us, bucket i holds durations in
+    /// [2^(i-1), 2^i) microseconds, and the last bucket holds everything above
+    static const int kNumBuckets = 32;
+
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    /// Record a single duration in microseconds. Negative durations are
+    /// recorded as zero.
+    void Record(int64_t micros);
+
+    /// Get the number of recorded durations
+    inline uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+
+    /// Get the mean of the recorded durations in microseconds
+    int64_t mean() const;
+
+    /// Get the largest recorded duration in microseconds
+    inline int64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    /// Estimate the given percentile (0 to 100) in microseconds. The estimate
+    /// is the upper edge of the bucket containing the percentile.
+    int64_t Percentile(double p) const;
+
+private:
+    /// Number of durations in each bucket
+    std::atomic<uint64_t> m_buckets[kNumBuckets];
+
+    /// Total number of durations
+    std::atomic<uint64_t> m_count;
+
+    /// Sum of all durations in microseconds
+    std::atomic<int64_t> m_sum;
+
+    /// Largest duration in microseconds
+    std::atomic<int64_t> m_max;
+};
+
+/// Print a histogram summary (count, mean, percentiles, max) in milliseconds
+std::ostream& operator<<(std::ostream& out, const LatencyHistogram& hist);
+
+} // namespace streamer
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "packages/streamer/include/sdp.h"
+#include "packages/streamer/proto/signaler_options.pb.h"
+
+namespace streamer {
+
+/// Field trials that make webrtc offer, send and receive FlexFEC. They must
+/// be set before any peer connection is created, and stay set for as long
+/// as any exists.
+extern const char kFlexFecFieldTrials[];
+
+/// Fill in the loss resilience options that are left to the preset
+LossResilienceOptions ApplyLossResiliencePreset(LossResilienceOptions opts);
+
+/// Get what to keep in the video section of an offer for the given loss
+/// resilience options, with the preset already applied. The codecs are left
+/// to the caller.
+VideoSdpOptions VideoSdpOptionsFor(const LossResilienceOptions& opts);
+
+} // namespace streamer
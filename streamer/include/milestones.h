@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace streamer {
+
+/// Milestone is a step on the way from a video request to the first frame
+/// sent to the viewer. Sessions that switch cameras only pass the last two.
+enum class Milestone {
+    kSessionCreated,
+    kOfferSent,
+    kAnswerApplied,
+    kFirstRemoteCandidate,
+    kIceConnected,
+    kFirstFrameDelivered,
+    kFirstFrameEncoded,
+};
+
+/// The number of milestones
+const int kNumMilestones = static_cast<int>(Milestone::kFirstFrameEncoded) + 1;
+
+/// Get the name of a milestone, for logging
+const char* MilestoneName(Milestone milestone);
+
+/// MilestoneTimes records how long after a video request each milestone was
+/// first reached. Recording is lock-free and safe to call from any thread.
+class MilestoneTimes {
+public:
+    MilestoneTimes();
+
+    MilestoneTimes(const MilestoneTimes&) = delete;
+    MilestoneTimes& operator=(const MilestoneTimes&) = delete;
+
+    /// Start timing a request that arrived at the given time, as returned by
+    /// rtc::TimeMicros, forgetting the milestones of the previous request
+    void Start(int64_t request_us);
+
+    /// Record that a milestone was reached now. Returns true if it had not
+    /// been reached since the request.
+    bool Record(Milestone milestone);
+
+    /// Get the time from the request to a milestone in microseconds, or -1
+    /// if it has not been reached
+    int64_t elapsed_us(Milestone milestone) const;
+
+    /// Returns true, once per request, if the milestones are to be reported
+    inline bool TakeReport() { return !m_reported.exchange(true); }
+
+private:
+    /// The time at which the request arrived
+    std::atomic<int64_t> m_request_us;
+
+    /// The time at which each milestone was reached, or -1 if not yet
+    std::atomic<int64_t> m_reached_us[kNumMilestones];
+
+    /// Whether the milestones of this request have been reported
+    std::atomic<bool> m_reported;
+};
+
+} // namespace streamer
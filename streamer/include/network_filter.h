@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "webrtc/base/network.h"
+#include "webrtc/base/sigslot.h"
+
+namespace streamer {
+
+/// FilteredNetworkManager hides the networks on which ICE candidates should
+/// not be gathered from the port allocators. It wraps another network
+/// manager, which enumerates the networks of the machine.
+class FilteredNetworkManager : public rtc::NetworkManager, public sigslot::has_slots<> {
+public:
+    /// Construct a filter for the given network manager. Only networks on the
+    /// listed interfaces are kept, or all if the list is empty. IPv6 and
+    /// link-local networks are dropped if requested.
+    FilteredNetworkManager(std::unique_ptr<rtc::NetworkManager> networks,
+        const std::vector<std::string>& interfaces,
+        bool disable_ipv6,
+        bool disable_link_local);
+
+    FilteredNetworkManager(const FilteredNetworkManager&) = delete;
+    FilteredNetworkManager& operator=(const FilteredNetworkManager&) = delete;
+
+    // rtc::NetworkManager implementation
+    void Initialize() override;
+    void StartUpdating() override;
+    void StopUpdating() override;
+    void GetNetworks(NetworkList* networks) const override;
+    void GetAnyAddressNetworks(NetworkList* networks) override;
+    EnumerationPermission enumeration_permission() const override;
+    bool GetDefaultLocalAddress(int family, rtc::IPAddress* ipaddr) const override;
+
+private:
+    /// Returns true if candidates may be gathered on the given network
+    bool Allowed(const rtc::Network& network) const;
+
+    /// Remove the networks on which candidates may not be gathered
+    void Filter(NetworkList* networks) const;
+
+    /// Pass on changes to the networks of the wrapped manager
+    void OnNetworksChanged();
+
+    /// Pass on errors of the wrapped manager
+    void OnError();
+
+    /// The wrapped network manager
+    std::unique_ptr<rtc::NetworkManager> m_networks;
+
+    /// Names of the interfaces to keep, or empty to keep all
+    std::vector<std::string> m_interfaces;
+
+    /// Whether IPv6 networks are dropped
+    bool m_disable_ipv6;
+
+    /// Whether link-local networks are dropped
+    bool m_disable_link_local;
+};
+
+} // namespace streamer
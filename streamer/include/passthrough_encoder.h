@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "webrtc/video_encoder.h"
+
+namespace streamer {
+
+/// PassthroughEncoder implements webrtc::VideoEncoder for frames that were
+/// already encoded, either to H.264 by the camera or to VP8 by a
+/// SharedEncoder. Each EncodedFrameBuffer is handed to the packetizer as is.
+/// Until a keyframe arrives, and whenever a frame went missing on the way,
+/// delta frames are dropped and a keyframe is requested from the encoder.
+/// Raw frames are handed to the fallback encoder, if there is one.
+class PassthroughEncoder : public webrtc::VideoEncoder {
+public:
+    /// Construct an encoder that encodes raw frames with FALLBACK, or
+    /// rejects them if null
+    explicit PassthroughEncoder(std::unique_ptr<webrtc::VideoEncoder> fallback = nullptr);
+
+    PassthroughEncoder(const PassthroughEncoder&) = delete;
+    PassthroughEncoder& operator=(const PassthroughEncoder&) = delete;
+
+    // webrtc::VideoEncoder implementation
+    int32_t InitEncode(const webrtc::VideoCodec* codec_settings, int32_t number_of_cores, size_t max_payload_size) override;
+    int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) override;
+    int32_t Release() override;
+    int32_t Encode(const webrtc::VideoFrame& frame,
+        const webrtc::CodecSpecificInfo* codec_specific_info,
+        const std::vector<webrtc::FrameType>* frame_types) override;
+    int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override;
+    int32_t SetRateAllocation(const webrtc::BitrateAllocation& allocation, uint32_t framerate) override;
+    ScalingSettings GetScalingSettings() const override;
+    bool SupportsNativeHandle() const override;
+    const char* ImplementationName() const override;
+
+private:
+    /// The encoder for raw frames, or null if they are rejected
+    std::unique_ptr<webrtc::VideoEncoder> m_fallback;
+
+    /// The codec negotiated with the peer
+    webrtc::VideoCodecType m_codec_type;
+
+    /// Where encoded frames are delivered
+    webrtc::EncodedImageCallback* m_callback;
+
+    /// Whether delta frames are being dropped until the next keyframe
+    bool m_waiting_for_keyframe;
+
+    /// Sequence number of the last encoded frame seen, used to detect gaps
+    uint64_t m_last_sequence;
+
+    /// Whether any encoded frame has been seen yet
+    bool m_started;
+
+    /// Time at which a keyframe was last requested, or zero if never
+    int64_t m_last_request_ms;
+};
+
+} // namespace streamer
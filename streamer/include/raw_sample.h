@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "zmq.hpp"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+
+namespace streamer {
+
+/// RawSample is a camera sample whose pixel data is read in place from the
+/// ZMQ message it arrived in.
+///
+/// Publishers that want to avoid copies send three frames: the topic, a
+/// hal::CameraSample with an empty image data field, and the raw pixels.
+/// Samples published as a single serialized hal::CameraSample are still
+/// accepted, in which case the pixels are read from the parsed protobuf.
+class RawSample {
+public:
+    RawSample() = default;
+
+    RawSample(const RawSample&) = delete;
+    RawSample& operator=(const RawSample&) = delete;
+
+    /// Get the sample metadata. The image data field is empty when the
+    /// pixels arrived in a separate frame.
+    inline const hal::CameraSample& metadata() const { return m_metadata; }
+
+    /// Get a pointer to the pixel data
+    inline const uint8_t* data() const { return m_data; }
+
+    /// Get the size of the pixel data in bytes
+    inline size_t size() const { return m_size; }
+
+    /// Get the time at which the sample was captured in nanoseconds since the
+    /// unix epoch, or zero if the publisher did not set it
+    inline int64_t capture_time_ns() const { return m_metadata.systemtimestamp().nanos(); }
+
+    /// Get the time elapsed since the sample was captured in microseconds, or
+    /// -1 if the publisher did not set the capture time
+    int64_t age_us() const;
+
+    /// Take ownership of the message holding the pixels, so that they stay
+    /// valid after the next sample is received. The data pointer may change,
+    /// so data() must be read again afterwards. Returns null if the pixels
+    /// are embedded in the metadata.
+    std::shared_ptr<zmq::message_t> ReleasePayload();
+
+private:
+    friend bool ReceiveSample(zmq::socket_t& socket, RawSample* sample, std::chrono::milliseconds timeout);
+
+    /// The sample metadata
+    hal::CameraSample m_metadata;
+
+    /// The frames of the most recently received message
+    zmq::message_t m_parts[3];
+
+    /// Whether the pixels are in the last of the frames above
+    bool m_separate_payload = false;
+
+    /// Pointer to the pixel data, which lives in one of the frames above or
+    /// in the metadata
+    const uint8_t* m_data = nullptr;
+
+    /// Size of the pixel data in bytes
+    size_t m_size = 0;
+};
+
+/// ReceiveSample waits up to TIMEOUT for the next sample on the socket. It
+/// returns false on timeout or if the sample could not be parsed.
+bool ReceiveSample(zmq::socket_t& socket, RawSample* sample, std::chrono::milliseconds timeout);
+
+/// SampleWaiting returns true if a sample can be received from the socket
+/// without blocking
+bool SampleWaiting(zmq::socket_t& socket);
+
+/// SendSample publishes a sample on the socket with its pixels in a separate
+/// frame so that receivers can read them without copying. Any data already in
+/// the sample image is ignored.
+bool SendSample(zmq::socket_t& socket, const std::string& topic, const hal::CameraSample& sample, const void* pixels, size_t size);
+
+} // namespace streamer
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace streamer {
+
+/// VideoSdpOptions describes what to keep in the video section of an SDP
+struct VideoSdpOptions {
+    /// Media codecs to offer in order of preference, or empty to keep the
+    /// media codecs already there in their original order
+    std::vector<std::string> codecs;
+
+    /// Whether to keep the retransmission payloads of the kept codecs
+    bool rtx = true;
+
+    /// Whether to keep generic NACK feedback. Picture loss indications are
+    /// always kept, since without them nobody asks for keyframes.
+    bool nack = true;
+
+    /// Protection payloads to keep, e.g. "red" and "ulpfec", or "flexfec-03"
+    std::vector<std::string> fec = { "red", "ulpfec", "flexfec-03" };
+};
+
+/// RewriteVideoSdp rewrites the video section of an SDP to keep only what is
+/// described in the options. The SSRC groups and SSRCs of repair streams
+/// that are not kept go as well. Codec names are compared without regard to
+/// case. Returns false and leaves the SDP alone if none of the named codecs
+/// are present.
+bool RewriteVideoSdp(std::string* sdp, const VideoSdpOptions& opts);
+
+} // namespace streamer
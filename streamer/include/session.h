@@ -1,20 +1,31 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include "webrtc/api/jsep.h"
 #include "webrtc/api/peerconnectioninterface.h"
 #include "webrtc/api/test/fakeconstraints.h"
 #include "webrtc/p2p/client/basicportallocator.h"
 
-#include "packages/hal/proto/camera_sample.pb.h"
-#include "packages/net/include/zmq_topic_sub.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/frame_watch.h"
+#include "packages/streamer/include/latency.h"
+#include "packages/streamer/include/milestones.h"
+#include "packages/streamer/include/sdp.h"
 #include "packages/streamer/proto/stream.pb.h"
 
 namespace streamer {
 
-class Session {
+// forward declarations
+class SharedEncoder;
+class VideoCapturer;
+
+class Session : public FrameSink {
 public:
     /// Events related to the connection
     typedef std::function<void(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream)> AddStreamHandler; ///< since 7f0676
@@ -26,6 +37,7 @@ public:
     typedef std::function<void(webrtc::PeerConnectionInterface::IceGatheringState new_state)> IceGatheringChangeHandler;
     typedef std::function<void()> RenegotiationNeededHandler;
     typedef std::function<void()> ClosedHandler;
+    typedef std::function<void()> FirstFrameEncodedHandler;
 
     /// CreateSessionDescriptionObserver
     typedef std::function<void(webrtc::SessionDescriptionInterface* desc)> SDPCreatedHandler;
@@ -44,8 +56,14 @@ public:
     inline void OnSDPFailure(SDPFailureHandler h) { m_sdp_failure_handler = h; }
     inline void OnClosed(ClosedHandler h) { m_closed_handler = h; }
 
-    /// Construct a session with a label (used for logging only)
-    Session(const std::string& label, zmq::context_t* ctx);
+    /// Set the handler called from an encoder thread when the first frame
+    /// since the last video request has been encoded. Must be set before the
+    /// connection.
+    inline void OnFirstFrameEncoded(FirstFrameEncodedHandler h) { m_first_frame_encoded_handler = h; }
+
+    /// Construct a session with a label (used for logging only) that draws
+    /// frames from the given registry
+    Session(const std::string& label, FrameSourceRegistry* sources);
 
     /// Default descructor
     virtual ~Session();
@@ -61,6 +79,9 @@ public:
     /// Receive a remote offer or answer.
     virtual void SetRemoteDescription(const std::string& type, const std::string& sdp);
 
+    /// Returns true once an answer to our offer has been applied
+    inline bool answered() const { return m_answered; }
+
     /// Receive a remote candidate.
     virtual void AddIceCandidate(const std::string& mid, int mlineindex, const std::string& sdp);
 
@@ -73,22 +94,85 @@ public:
     /// Get the constraints for this Session
     inline webrtc::FakeConstraints* constraints() { return &m_constraints; }
 
-    /// Set the connection
-    inline void SetConnection(rtc::scoped_refptr<webrtc::PeerConnectionInterface> conn) { m_connection = conn; }
+    /// Set the connection and apply the bitrate bounds of the current source
+    void SetConnection(rtc::scoped_refptr<webrtc::PeerConnectionInterface> conn);
 
-    /// Connect changes the video source for this session
+    /// Connect changes the video source for this session and applies its
+    /// bitrate bounds. The bandwidth estimate restarts from the start bitrate
+    /// of the new source whenever the source changes. The source is only
+    /// subscribed to while the ICE connection is up. Sources that are
+    /// shared draw encoded frames from the tier that best fits the output
+    /// size. A session cannot switch between sources that are sent with
+    /// different codecs.
     void Connect(const Stream& source);
 
-    /// NextFrame gets the next video frame for this session, or returns false if no frame is available
-    bool NextFrame(hal::CameraSample& sample, int& outputWidth, int& outputHeight);
+    /// Set the video track fed by this session and apply the content hint of
+    /// the current source to it
+    void SetVideoTrack(rtc::scoped_refptr<webrtc::VideoTrackInterface> track);
+
+    /// Returns true if the encoder should drop frame rate rather than
+    /// resolution, which webrtc derives from whether the video is a screencast
+    inline bool maintain_resolution() const { return m_maintain_resolution; }
+
+    /// Restrict the video codecs, retransmission, feedback and protection
+    /// offered to the peer. Must be called before CreateOffer.
+    inline void SetVideoSdpOptions(const VideoSdpOptions& opts) { m_sdp_options = opts; }
+
+    /// Returns true if the session passes encoded frames through
+    inline bool encoded() const { return !m_encoded_codec.empty(); }
+
+    /// Get the codec in which encoded frames are passed through, or an empty
+    /// string if the session encodes its own
+    inline const std::string& encoded_codec() const { return m_encoded_codec; }
+
+    /// AttachCapturer starts routing frames from the current source to the capturer
+    void AttachCapturer(VideoCapturer* capturer);
+
+    /// DetachCapturer stops routing frames to the capturer. No frames will be
+    /// delivered to the capturer after this returns.
+    void DetachCapturer(VideoCapturer* capturer);
+
+    /// FrameSink implementation
+    virtual bool WantsFrame(int width, int height, int64_t timestamp_us) override;
+    virtual void OnSourceFrame(const Frame& frame) override;
+
+    /// Get the times at which the last video request reached each milestone
+    inline MilestoneTimes* milestones() { return &m_milestones; }
+
+    /// Print latency histograms for this session
+    void PrintStats(std::ostream& out);
 
 private:
+    /// Apply the bitrate bounds to the connection, restarting the bandwidth
+    /// estimate from the start bitrate if RESTART is set
+    void ApplyBitrate(bool restart);
+
+    /// Apply the content hint to the video track
+    void ApplyContentHint();
+
+    /// Start drawing frames from the current source if ACTIVE is set, or stop
+    /// if not. Called on the signaling thread as the ICE connection comes and
+    /// goes.
+    void SetActive(bool active);
+
+    /// Acquire the current source and start drawing frames from it. Called
+    /// with m_subscription_guard held.
+    void Subscribe();
+
+    /// Stop drawing frames and let go of the source. Called with
+    /// m_subscription_guard held.
+    void Unsubscribe();
+
+    /// Record that our encoder has encoded a frame of the last request.
+    /// Called from an encoder thread, which cannot outlive the connection.
+    void OnFrameEncoded();
+
     /// Observer receives webrtc events and routes them to handlers
     class Observer;
     friend class Observer;
 
-    /// The zmq context
-    zmq::context_t* m_ctx;
+    /// The registry from which we acquire frame sources
+    FrameSourceRegistry* m_sources;
 
     /// The event observer
     std::unique_ptr<Observer> m_observer;
@@ -129,27 +213,93 @@ private:
     /// Handler for connection closed event
     ClosedHandler m_closed_handler;
 
+    /// Handler for the first frame of a request being encoded
+    FirstFrameEncodedHandler m_first_frame_encoded_handler;
+
     /// Handler for SDP success event
     SDPCreatedHandler m_sdp_created_handler;
 
     /// Handler for SDP failure event
     SDPFailureHandler m_sdp_failure_handler;
 
-    /// The socket from which we are currently reading frames
-    std::unique_ptr<zmq::socket_t> m_frame_socket;
+    /// Whether an answer to our offer was applied. Set on the thread that
+    /// handles backend messages and read on the signaling thread.
+    std::atomic<bool> m_answered;
+
+    /// The source requested by the last call to Connect
+    Stream m_stream;
+
+    /// Whether Connect was called yet
+    bool m_has_stream;
+
+    /// Whether the ICE connection is up, so that frames should be drawn
+    bool m_active;
+
+    /// The mutex protecting access to m_active and serializing Subscribe and
+    /// Unsubscribe, so that Connect on the thread that handles backend
+    /// messages cannot subscribe after the signaling thread has seen the ICE
+    /// connection go down
+    std::mutex m_subscription_guard;
 
-    /// The next socket that will replace the socket above when we are done
-    /// reading the current frame
-    std::unique_ptr<zmq::socket_t> m_next_frame_socket;
+    /// The source from which we are currently drawing frames, or null while
+    /// the ICE connection is down
+    std::shared_ptr<FrameSource> m_source;
 
-    /// The mutex protecting access to m_next_frame_socket
-    std::mutex m_socket_guard;
+    /// The shared encoder of m_source from which we are drawing encoded
+    /// frames, or null if we draw frames from the source itself
+    SharedEncoder* m_shared_encoder;
+
+    /// The capturer to which frames are routed, or null if not capturing
+    VideoCapturer* m_capturer;
+
+    /// Watches the frames handed to the capturer until the first frame of
+    /// the last request has been encoded
+    std::shared_ptr<FrameWatch> m_encoded_watch;
+
+    /// The mutex protecting access to m_stream, m_source, m_shared_encoder,
+    /// m_capturer and the output size
+    std::mutex m_frame_guard;
 
     /// Desired output width
     int m_output_width;
 
     /// Desired output height
     int m_output_height;
+
+    /// The codec in which the source delivers encoded frames, or empty if it
+    /// delivers raw frames
+    std::string m_encoded_codec;
+
+    /// Bitrate bounds of the current source, in kilobits per second, or zero
+    /// for the webrtc defaults
+    int m_min_bitrate_kbps;
+    int m_start_bitrate_kbps;
+    int m_max_bitrate_kbps;
+
+    /// The video track fed by this session, or null if not created yet
+    rtc::scoped_refptr<webrtc::VideoTrackInterface> m_track;
+
+    /// The content hint of the current source
+    Stream::ContentHint m_content_hint;
+
+    /// The degradation preference of the current source
+    Stream::DegradationPreference m_degradation;
+
+    /// Whether the current source prefers dropping frame rate over
+    /// resolution. Read by the capturer from a webrtc thread.
+    std::atomic<bool> m_maintain_resolution;
+
+    /// What to offer in the video section of the SDP
+    VideoSdpOptions m_sdp_options;
+
+    /// Time spent scaling and handing each frame to the capturer
+    LatencyHistogram m_dispatch_latency;
+
+    /// Time from capture until each frame was handed to the capturer
+    LatencyHistogram m_frame_age;
+
+    /// Times at which the last video request reached each milestone
+    MilestoneTimes m_milestones;
 };
 
 } // namespace streamer
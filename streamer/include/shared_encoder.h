@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+#include "webrtc/video_encoder.h"
+
+#include "packages/streamer/include/encoded_frame.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/latency.h"
+#include "packages/streamer/proto/stream.pb.h"
+
+namespace streamer {
+
+/// PendingKeyframe collects keyframe requests from every session watching a
+/// SharedEncoder. The encoder produces a keyframe for the next frame after a
+/// request was passed on.
+class PendingKeyframe : public KeyframeRequester {
+public:
+    explicit PendingKeyframe(std::chrono::milliseconds min_interval);
+
+    /// Returns true, once, if a keyframe was requested since the last call
+    inline bool Take() { return m_pending.exchange(false); }
+
+protected:
+    /// Mark a keyframe as pending
+    bool Send() override;
+
+private:
+    /// Whether a keyframe was requested since it was last taken
+    std::atomic<bool> m_pending;
+};
+
+/// SharedEncoder encodes the frames of one FrameSource to VP8 once, at the
+/// fixed size and bitrate of an EncodingTier, and hands the encoded frames to
+/// every session attached to it. Sessions pass them through to their peers
+/// unchanged, so the cost of encoding does not grow with the number of
+/// viewers. The price is that the bitrate cannot adapt to any single peer.
+/// The dispatcher worker handling the source only scales the frame, and each
+/// tier encodes on a thread of its own, so the tiers encode in parallel and
+/// the source is not held up. A frame that arrives while the previous one is
+/// still being encoded waits, replacing any frame already waiting.
+class SharedEncoder : public FrameSink, public webrtc::EncodedImageCallback {
+public:
+    /// Construct an encoder for the given tier of the source with the given
+    /// label. Keyframes requested by the sessions are produced at most once
+    /// per MIN_KEYFRAME_INTERVAL. The encoder is told about at most MAX_CORES
+    /// cores, from which it picks its thread count.
+    SharedEncoder(const std::string& label, const EncodingTier& tier, std::chrono::milliseconds min_keyframe_interval, int max_cores);
+
+    /// Stops the encoding thread and releases the encoder
+    ~SharedEncoder();
+
+    SharedEncoder(const SharedEncoder&) = delete;
+    SharedEncoder& operator=(const SharedEncoder&) = delete;
+
+    /// Start delivering encoded frames to the given sink
+    void AddSink(FrameSink* sink);
+
+    /// Stop delivering encoded frames to the given sink. No calls to the sink
+    /// will be made after this returns.
+    void RemoveSink(FrameSink* sink);
+
+    /// Get the width of the encoded frames
+    inline int width() const { return m_tier.width(); }
+
+    /// Get the height of the encoded frames
+    inline int height() const { return m_tier.height(); }
+
+    /// FrameSink implementation. Frames are only wanted while at least one
+    /// attached sink wants them, at no more than the tier frame rate.
+    bool WantsFrame(int width, int height, int64_t timestamp_us) override;
+    void OnSourceFrame(const Frame& frame) override;
+
+    /// webrtc::EncodedImageCallback implementation
+    Result OnEncodedImage(const webrtc::EncodedImage& image,
+        const webrtc::CodecSpecificInfo* info,
+        const webrtc::RTPFragmentationHeader* fragmentation) override;
+
+    /// Print latency histograms and counters for this encoder
+    void PrintStats(std::ostream& out);
+
+private:
+    /// A scaled frame waiting to be encoded
+    struct Pending {
+        /// The pixels at the tier size
+        rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+
+        /// The capture times of the frame, as in Frame
+        int64_t timestamp_us;
+        int64_t capture_time_ns;
+
+        /// The sinks that wanted the frame
+        std::vector<FrameSink*> sinks;
+    };
+
+    /// Create and configure the encoder. Returns false if that failed.
+    bool StartEncoder();
+
+    /// Encode frames as they arrive until stopped. Runs on m_thread.
+    void Run();
+
+    /// The label of the source and tier, used for logging only
+    std::string m_label;
+
+    /// The size, bitrate and frame rate at which we encode
+    EncodingTier m_tier;
+
+    /// The most cores the encoder is told about
+    int m_max_cores;
+
+    /// The encoder, or null until the first frame is wanted. Only used on
+    /// m_thread.
+    std::unique_ptr<webrtc::VideoEncoder> m_encoder;
+
+    /// Whether the encoder could not be configured, in which case we stop trying
+    bool m_failed;
+
+    /// Keyframe requests from the sessions
+    std::shared_ptr<PendingKeyframe> m_keyframes;
+
+    /// Number of frames encoded so far, used as the sequence number of the next
+    uint64_t m_sequence;
+
+    /// Capture time before which the next frame is dropped to keep to the
+    /// tier frame rate
+    int64_t m_next_frame_us;
+
+    /// The frame being encoded, which is only set on m_thread during Encode
+    const Pending* m_encoding;
+
+    /// The sinks to which encoded frames are dispatched
+    std::vector<FrameSink*> m_sinks;
+
+    /// The mutex protecting access to m_sinks and m_next_frame_us. Held
+    /// while encoded frames are handed to the sinks, so that none is called
+    /// once it has been removed.
+    std::mutex m_sink_guard;
+
+    /// The frame waiting to be encoded, if any
+    std::unique_ptr<Pending> m_pending;
+
+    /// Whether the encoding thread should stop
+    bool m_stopping;
+
+    /// The mutex protecting access to m_pending and m_stopping
+    std::mutex m_pending_guard;
+
+    /// Signalled when a frame is waiting or the thread should stop
+    std::condition_variable m_pending_cond;
+
+    /// The thread on which frames are encoded
+    std::thread m_thread;
+
+    /// Time spent encoding each frame
+    LatencyHistogram m_encode_latency;
+
+    /// Number of keyframes encoded
+    uint64_t m_keyframe_count;
+
+    /// Number of frames replaced by a newer one before they were encoded
+    std::atomic<uint64_t> m_superseded;
+};
+
+} // namespace streamer
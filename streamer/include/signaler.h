@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
 
 #include "packages/streamer/proto/signaler_options.pb.h"
 #include "packages/streamer/proto/stream.pb.h"
@@ -23,8 +25,10 @@ public:
     /// Set the handler to be called when the signaler emits a message.
     inline void OnEmit(emit_handler handler) { m_emit_handler = handler; }
 
-    /// Called when a VideoRequest message arrives over the websocket
-    void HandleVideoRequest(const std::string& conn_id, const Stream& source);
+    /// Called when a VideoRequest message arrives over the websocket.
+    /// REQUEST_US is when the message arrived, on the rtc::TimeMicros clock,
+    /// from which the session's milestones are timed.
+    void HandleVideoRequest(const std::string& conn_id, const Stream& source, int64_t request_us);
 
     /// Called when an SDPRequest message arrives over the websocket
     void HandleSDPRequest(const teleop::SDPRequest& msg);
@@ -32,6 +36,12 @@ public:
     /// Called when an ICECandidate message arrives over the websocket
     void HandleICECandidate(const teleop::ICECandidate& msg);
 
+    /// Called when a CloseConnection message arrives over the websocket
+    void HandleCloseConnection(const teleop::CloseConnection& msg);
+
+    /// Get latency histograms for every video source and session as text
+    std::string DumpStats();
+
 private:
     /// Forward declaration of SignallerImpl, which hides the implementation using the pimpl idiom
     class Impl;
@@ -1,10 +1,10 @@
 #pragma once
 
-#include <atomic>
+#include <memory>
 #include <string>
-#include <thread>
 
-#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/frame_watch.h"
 #include "packages/streamer/proto/stream.pb.h"
 
 #include "webrtc/api/video/i420_buffer.h"
@@ -15,11 +15,14 @@ namespace streamer {
 // forward declarations
 class Session;
 
-/// VideoCapturer implements cricket::VideoCapturer by converting
-/// hal::CameraSample to YUV.
+/// VideoCapturer implements cricket::VideoCapturer by dispatching the shared
+/// I420 frames of a FrameSource at the output size of its session, reduced
+/// further as requested by the sink wants of the encoder. The capturer is
+/// owned by the webrtc track source and may outlive its session, after
+/// which it delivers nothing.
 class VideoCapturer : public cricket::VideoCapturer {
 public:
-    VideoCapturer(Session* session);
+    VideoCapturer(std::weak_ptr<Session> session);
     virtual ~VideoCapturer();
 
     VideoCapturer(const VideoCapturer&) = delete;
@@ -33,33 +36,37 @@ public:
     virtual bool IsRunning() override;
     virtual bool IsScreencast() const override;
 
-protected:
-    // polls for the next frame
-    void NextFrame();
+    // called by the session before conversion to decide whether the next
+    // frame would survive adaptation to the sink wants, given the output
+    // size requested by the session
+    bool WantsFrame(int output_width, int output_height, int64_t timestamp_us);
 
-    // the poll loop that runs on a separate thread
-    void Loop();
+    // called by the session for every converted frame that we wanted. If
+    // WATCH is set, the frame is handed on in a buffer of its own and watched
+    // until the encoder of this session has encoded it.
+    void HandleFrame(const Frame& frame, const std::shared_ptr<FrameWatch>& watch = nullptr);
 
+protected:
     // reference back to the session from which we draw frames
-    Session* session_;
-
-    // buffer for storing incoming frames
-    hal::CameraSample sample_;
+    std::weak_ptr<Session> session_;
 
     // the video format
     cricket::VideoFormat format_;
 
-    // the thread on which we read frames
-    std::thread thread_;
-
-    // the signal used to stop the thread
-    std::atomic_bool should_continue_;
+    // the output size requested by the session for the next frame
+    int output_width_;
+    int output_height_;
 
-    // the buffer for storing YUV frames at the input size
-    rtc::scoped_refptr<webrtc::I420Buffer> unscaled_;
+    // the size of the next frame after adaptation to the sink wants
+    int adapted_width_;
+    int adapted_height_;
 
-    // the buffer for storing YUV frames after rescaling to the output size
-    rtc::scoped_refptr<webrtc::I420Buffer> scaled_;
+    // the part of the output that the adapter keeps for the next frame, in
+    // output coordinates
+    int crop_x_;
+    int crop_y_;
+    int crop_width_;
+    int crop_height_;
 };
 
 } // namespace streamer
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace streamer {
+
+/// WorkerPool runs tasks on a fixed set of threads
+class WorkerPool {
+public:
+    /// Start the given number of worker threads, or one per core if zero
+    WorkerPool(size_t num_threads);
+
+    /// Runs any tasks that are still queued and then joins the workers
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /// Queue a task to be run on one of the workers
+    void Post(std::function<void()> task);
+
+    /// Call FN once for each index in [0, COUNT) spread over the workers, and
+    /// return once every call has finished. The calling thread takes part in
+    /// the work, so this is safe to call from a worker even when every other
+    /// worker is busy.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+    /// Get the number of worker threads
+    inline size_t size() const { return m_threads.size(); }
+
+private:
+    /// The loop that runs on each worker thread
+    void Loop();
+
+    /// The worker threads
+    std::vector<std::thread> m_threads;
+
+    /// Tasks waiting for a worker
+    std::deque<std::function<void()> > m_tasks;
+
+    /// The signal used to stop the workers
+    bool m_should_continue;
+
+    /// The mutex protecting access to m_tasks and m_should_continue
+    std::mutex m_guard;
+
+    /// Signalled when a task is queued or the pool is stopping
+    std::condition_variable m_wakeup;
+};
+
+} // namespace streamer
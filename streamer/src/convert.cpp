@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "libyuv.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/convert.h"
+#include "packages/streamer/include/worker_pool.h"
+
+namespace streamer {
+
+namespace {
+    // Number of output rows converted per strip in the fused path. Must be
+    // even so that strips start on a chroma row.
+    const int kStripRows = 8;
+
+    // Get the number of bytes per pixel for a packed format, or zero for
+    // planar formats
+    int PixelDepth(PixelFormat format) {
+        switch (format) {
+        case PixelFormat::Gray:
+            return 1;
+        case PixelFormat::RGB:
+            return 3;
+        case PixelFormat::RGBA:
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    // Get the libyuv fourcc for a format, or zero if there is none
+    uint32_t FourccFor(PixelFormat format) {
+        switch (format) {
+        case PixelFormat::RGB:
+            return libyuv::FOURCC_RAW;
+        case PixelFormat::RGBA:
+            return libyuv::FOURCC_RGBA;
+        case PixelFormat::I420:
+            return libyuv::FOURCC_I420;
+        case PixelFormat::NV12:
+            return libyuv::FOURCC_NV12;
+        case PixelFormat::YUYV:
+            return libyuv::FOURCC_YUY2;
+        default:
+            return 0;
+        }
+    }
+
+    // Split ROWS output rows into contiguous bands whose size is a multiple of
+    // GRANULARITY and call FN with the first row and row count of each band,
+    // one band per worker. Runs FN once on the calling thread if WORKERS is
+    // null. Returns false if any call to FN failed.
+    bool ForEachBand(WorkerPool* workers, int rows, int granularity, const std::function<bool(int, int)>& fn) {
+        const int max_bands = (rows + granularity - 1) / granularity;
+        const int bands = workers ? std::min<int>(workers->size(), max_bands) : 1;
+        if (bands <= 1) {
+            return fn(0, rows);
+        }
+
+        const int band_rows = (max_bands + bands - 1) / bands * granularity;
+        std::atomic<bool> ok(true);
+        workers->ParallelFor(bands, [&](size_t i) {
+            const int first = i * band_rows;
+            const int count = std::min(band_rows, rows - first);
+            if (count > 0 && !fn(first, count)) {
+                ok = false;
+            }
+        });
+        return ok;
+    }
+
+    bool ConvertToYUV(const ImageView& in, int first_row, int rows, webrtc::I420Buffer* out) {
+        CHECK_GT(in.width, 0);
+        CHECK_GT(in.height, 0);
+        CHECK_EQ(in.size, ImageSize(in.format, in.width, in.height));
+        CHECK_NOTNULL(in.data);
+
+        // Convert frame to YUV, reading the pixels in place. YUV inputs are
+        // only repacked. Use libyuv directly since WebRTC wrappers don't
+        // support RGBA.
+        if (libyuv::ConvertToI420( // params for conversion
+                in.data, // input frame
+                in.size, // input size
+                out->MutableDataY() + first_row * out->StrideY(), // output Y plane
+                out->StrideY(), // output Y stride
+                out->MutableDataU() + first_row / 2 * out->StrideU(), // output U plane
+                out->StrideU(), // output U stride
+                out->MutableDataV() + first_row / 2 * out->StrideV(), // output V plane
+                out->StrideV(), // output V stride
+                0, // no cropping in x
+                first_row, // crop to this band in y
+                in.width, // input width
+                in.height, // input height
+                in.width, // output width (we are not scaling here)
+                rows, // output height (we are not scaling here)
+                libyuv::kRotate0, // no rotation
+                FourccFor(in.format))
+            != 0) {
+            LOG(ERROR) << "failed to convert frame to I420";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool ConvertGrayToYUV(const ImageView& in, int first_row, int rows, webrtc::I420Buffer* out) {
+        CHECK_GT(in.width, 0);
+        CHECK_GT(in.height, 0);
+        CHECK_EQ(in.size, ImageSize(in.format, in.width, in.height));
+        CHECK_NOTNULL(in.data);
+
+        // Convert frame from RGBA to YUV, reading the pixels in place
+        // Use libyuv directly since WebRTC wrappers don't support RGBA.
+        if (libyuv::I400ToI420( // params for conversion
+                in.data + first_row * in.width, // input Y plane
+                in.width, // input Y stride
+                out->MutableDataY() + first_row * out->StrideY(), // output Y plane
+                out->StrideY(), // output Y stride
+                out->MutableDataU() + first_row / 2 * out->StrideU(), // output U plane
+                out->StrideU(), // output U stride
+                out->MutableDataV() + first_row / 2 * out->StrideV(), // output V plane
+                out->StrideV(), // output V stride
+                in.width, // input width
+                rows // input height
+                )
+            != 0) {
+            LOG(ERROR) << "failed to convert frame to I420";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool ConvertAndScaleGray(const ImageView& in, int first_row, int rows, webrtc::I420Buffer* out) {
+        const int factor_y = in.height / out->height();
+
+        // Luminance needs no color conversion, so downsample straight into
+        // the Y plane and fill the chroma planes with neutral gray
+        libyuv::ScalePlane( // params for scaling
+            in.data + first_row * factor_y * in.width, // input plane
+            in.width, // input stride
+            in.width, // input width
+            rows * factor_y, // input height
+            out->MutableDataY() + first_row * out->StrideY(), // output Y plane
+            out->StrideY(), // output Y stride
+            out->width(), // output width
+            rows, // output height
+            libyuv::kFilterBox);
+
+        const int chroma_rows = (rows + 1) / 2;
+        libyuv::SetPlane(out->MutableDataU() + first_row / 2 * out->StrideU(), out->StrideU(), out->ChromaWidth(), chroma_rows, 128);
+        libyuv::SetPlane(out->MutableDataV() + first_row / 2 * out->StrideV(), out->StrideV(), out->ChromaWidth(), chroma_rows, 128);
+        return true;
+    }
+
+    bool ConvertAndScaleColor(const ImageView& in, int first_row, int rows, webrtc::I420Buffer* out) {
+        const int depth = PixelDepth(in.format);
+        const int src_stride = in.width * depth;
+        const int factor_y = in.height / out->height();
+
+        // Scratch space for one strip, reused across calls on each thread
+        thread_local std::vector<uint8_t> unpacked;
+        thread_local std::vector<uint8_t> scaled;
+        scaled.resize(out->width() * 4 * kStripRows);
+        if (in.format == PixelFormat::RGB) {
+            unpacked.resize(in.width * 4 * kStripRows * factor_y);
+        }
+
+        for (int y = first_row; y < first_row + rows; y += kStripRows) {
+            const int strip_rows = std::min(kStripRows, first_row + rows - y);
+            const uint8_t* src = in.data + y * factor_y * src_stride;
+
+            // Since the input is a whole multiple of the output, the output
+            // rows of this strip depend only on these input rows
+            const uint8_t* argb = src;
+            int argb_stride = src_stride;
+            if (in.format == PixelFormat::RGB) {
+                libyuv::RAWToARGB(src, src_stride, unpacked.data(), in.width * 4, in.width, strip_rows * factor_y);
+                argb = unpacked.data();
+                argb_stride = in.width * 4;
+            }
+
+            // Box filtering treats the four channels independently, so this
+            // works for RGBA as well as ARGB
+            if (libyuv::ARGBScale(argb, argb_stride, in.width, strip_rows * factor_y, scaled.data(), out->width() * 4, out->width(),
+                    strip_rows, libyuv::kFilterBox)
+                != 0) {
+                LOG(ERROR) << "failed to scale frame strip";
+                return false;
+            }
+
+            uint8_t* dst_y = out->MutableDataY() + y * out->StrideY();
+            uint8_t* dst_u = out->MutableDataU() + (y / 2) * out->StrideU();
+            uint8_t* dst_v = out->MutableDataV() + (y / 2) * out->StrideV();
+            int err;
+            if (in.format == PixelFormat::RGBA) {
+                err = libyuv::RGBAToI420(scaled.data(), out->width() * 4, dst_y, out->StrideY(), dst_u, out->StrideU(), dst_v,
+                    out->StrideV(), out->width(), strip_rows);
+            } else {
+                err = libyuv::ARGBToI420(scaled.data(), out->width() * 4, dst_y, out->StrideY(), dst_u, out->StrideU(), dst_v,
+                    out->StrideV(), out->width(), strip_rows);
+            }
+            if (err != 0) {
+                LOG(ERROR) << "failed to convert frame strip to I420";
+                return false;
+            }
+        }
+
+        return true;
+    }
+} // namespace
+
+PixelFormat PixelFormatFor(hal::Format format, Stream::InputFormat input_format) {
+    switch (input_format) {
+    case Stream::I420:
+        return PixelFormat::I420;
+    case Stream::NV12:
+        return PixelFormat::NV12;
+    case Stream::YUYV:
+        return PixelFormat::YUYV;
+    case Stream::H264:
+        return PixelFormat::H264;
+    default:
+        break;
+    }
+
+    switch (format) {
+    case hal::PB_LUMINANCE:
+        return PixelFormat::Gray;
+    case hal::PB_RGB:
+        return PixelFormat::RGB;
+    case hal::PB_RGBA:
+        return PixelFormat::RGBA;
+    case hal::PB_COMPRESSED_JPEG:
+        return PixelFormat::JPEG;
+    default:
+        return PixelFormat::Unknown;
+    }
+}
+
+size_t ImageSize(PixelFormat format, int width, int height) {
+    const size_t chroma_width = (width + 1) / 2;
+    const size_t chroma_height = (height + 1) / 2;
+    switch (format) {
+    case PixelFormat::I420:
+    case PixelFormat::NV12:
+        return size_t(width) * height + 2 * chroma_width * chroma_height;
+    case PixelFormat::YUYV:
+        return 4 * chroma_width * height;
+    case PixelFormat::JPEG:
+    case PixelFormat::H264:
+        return 0;
+    default:
+        return size_t(width) * height * PixelDepth(format);
+    }
+}
+
+bool ConvertImage(const ImageView& in, webrtc::I420Buffer* out, WorkerPool* workers) {
+    CHECK_EQ(in.width, out->width());
+    CHECK_EQ(in.height, out->height());
+
+    switch (in.format) {
+    case PixelFormat::Gray:
+        return ForEachBand(workers, in.height, 2, [&](int first, int rows) { return ConvertGrayToYUV(in, first, rows, out); });
+    case PixelFormat::RGB:
+    case PixelFormat::RGBA:
+    case PixelFormat::I420:
+    case PixelFormat::NV12:
+    case PixelFormat::YUYV:
+        return ForEachBand(workers, in.height, 2, [&](int first, int rows) { return ConvertToYUV(in, first, rows, out); });
+    default:
+        LOG(ERROR) << "cannot convert compressed image or image with unknown pixel format";
+        return false;
+    }
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> WrapI420Image(const ImageView& in, std::shared_ptr<void> owner) {
+    CHECK(in.format == PixelFormat::I420);
+    CHECK_EQ(in.size, ImageSize(in.format, in.width, in.height));
+    CHECK_NOTNULL(in.data);
+
+    const int stride_uv = (in.width + 1) / 2;
+    const uint8_t* y = in.data;
+    const uint8_t* u = y + in.width * in.height;
+    const uint8_t* v = u + stride_uv * ((in.height + 1) / 2);
+    return new rtc::RefCountedObject<webrtc::WrappedI420Buffer>(
+        in.width, in.height, y, in.width, u, stride_uv, v, stride_uv, [owner] {});
+}
+
+bool CanConvertAndScale(const ImageView& in, int width, int height) {
+    if (PixelDepth(in.format) == 0 || width <= 0 || height <= 0 || width > in.width || height > in.height) {
+        return false;
+    }
+    return in.width % width == 0 && in.height % height == 0 && (in.width != width || in.height != height);
+}
+
+bool ConvertAndScaleImage(const ImageView& in, webrtc::I420Buffer* out, WorkerPool* workers) {
+    CHECK(CanConvertAndScale(in, out->width(), out->height()));
+    CHECK_EQ(in.size, ImageSize(in.format, in.width, in.height));
+    CHECK_NOTNULL(in.data);
+
+    if (in.format == PixelFormat::Gray) {
+        return ForEachBand(workers, out->height(), 2, [&](int first, int rows) { return ConvertAndScaleGray(in, first, rows, out); });
+    }
+    return ForEachBand(
+        workers, out->height(), kStripRows, [&](int first, int rows) { return ConvertAndScaleColor(in, first, rows, out); });
+}
+
+bool ScaleYUV(const webrtc::VideoFrameBuffer& in, webrtc::I420Buffer* out) {
+    if (libyuv::I420Scale( // params for scaling
+            in.DataY(), // input Y plane
+            in.StrideY(), // input Y stride
+            in.DataU(), // input U plane
+            in.StrideU(), // input U stride
+            in.DataV(), // input V plane
+            in.StrideV(), // input V stride
+            in.width(), // input width
+            in.height(), // input height
+            out->MutableDataY(), // output Y plane
+            out->StrideY(), // output Y stride
+            out->MutableDataU(), // output U plane
+            out->StrideU(), // output U stride
+            out->MutableDataV(), // output V plane
+            out->StrideV(), // output V stride
+            out->width(), // output width
+            out->height(), // output height
+            libyuv::kFilterBox)
+        != 0) {
+        LOG(ERROR) << "failed to scale I420 frame";
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace streamer
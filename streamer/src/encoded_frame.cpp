@@ -0,0 +1,126 @@
+#include "glog/logging.h"
+
+#include "webrtc/base/timeutils.h"
+#include "webrtc/common_video/h264/h264_common.h"
+
+#include "packages/streamer/include/encoded_frame.h"
+
+namespace streamer {
+
+namespace {
+    // The tag stored as the native handle of every EncodedFrameBuffer, which
+    // tells them apart from native buffers of other kinds
+    int kEncodedFrameTag;
+} // namespace
+
+//
+// KeyframeRequester
+//
+
+KeyframeRequester::KeyframeRequester(std::chrono::milliseconds min_interval)
+    : m_min_interval(min_interval)
+    , m_last_ms(0)
+    , m_count(0)
+    , m_merged(0) {}
+
+void KeyframeRequester::Request() {
+    std::lock_guard<std::mutex> lock(m_guard);
+
+    // A keyframe asked for moments ago serves every receiver that is waiting
+    // for one, so there is no point in asking again until it had time to arrive
+    const int64_t now_ms = rtc::TimeMillis();
+    if (m_count > 0 && now_ms - m_last_ms < m_min_interval.count()) {
+        m_merged++;
+        return;
+    }
+    if (!Send()) {
+        return;
+    }
+    m_last_ms = now_ms;
+    m_count++;
+}
+
+//
+// ZmqKeyframeRequester
+//
+
+ZmqKeyframeRequester::ZmqKeyframeRequester(
+    zmq::context_t* ctx, const std::string& address, const std::string& topic, std::chrono::milliseconds min_interval)
+    : KeyframeRequester(min_interval)
+    , m_topic(topic)
+    , m_socket(*ctx, ZMQ_PUSH) {
+    LOG(INFO) << "sending keyframe requests for " << topic << " to " << address;
+    m_socket.setsockopt(ZMQ_SNDHWM, 1);
+    m_socket.setsockopt(ZMQ_LINGER, 0);
+    m_socket.connect(address);
+}
+
+bool ZmqKeyframeRequester::Send() {
+    if (m_socket.send(m_topic.data(), m_topic.size(), ZMQ_DONTWAIT) != m_topic.size()) {
+        LOG_EVERY_N(WARNING, 100) << "keyframe request for " << m_topic << " dropped, publisher is not reading them";
+        return false;
+    }
+    return true;
+}
+
+//
+// EncodedFrameBuffer
+//
+
+EncodedFrameBuffer::EncodedFrameBuffer(const uint8_t* data,
+    size_t size,
+    int width,
+    int height,
+    const webrtc::CodecSpecificInfo& info,
+    bool keyframe,
+    uint64_t sequence,
+    std::shared_ptr<void> owner,
+    std::shared_ptr<KeyframeRequester> keyframes)
+    : webrtc::NativeHandleBuffer(&kEncodedFrameTag, width, height)
+    , m_data(data)
+    , m_size(size)
+    , m_info(info)
+    , m_sequence(sequence)
+    , m_keyframe(keyframe)
+    , m_owner(std::move(owner))
+    , m_keyframes(std::move(keyframes)) {
+    CHECK_NOTNULL(data);
+}
+
+void EncodedFrameBuffer::RequestKeyframe() {
+    if (m_keyframes) {
+        m_keyframes->Request();
+    }
+}
+
+rtc::scoped_refptr<EncodedFrameBuffer> EncodedFrameBuffer::Alias(std::function<void()> released) const {
+    std::shared_ptr<void> owner = m_owner;
+    if (released) {
+        // The deleter runs when the alias lets go, and holds on to the bytes
+        owner = std::shared_ptr<void>(nullptr, [owner, released](void*) { released(); });
+    }
+    return new rtc::RefCountedObject<EncodedFrameBuffer>(m_data, m_size, width(), height(), m_info, m_keyframe, m_sequence, owner, m_keyframes);
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> EncodedFrameBuffer::NativeToI420Buffer() {
+    LOG_EVERY_N(ERROR, 100) << "encoded frames cannot be converted to I420";
+    return nullptr;
+}
+
+EncodedFrameBuffer* EncodedFrameBuffer::From(const webrtc::VideoFrameBuffer& buffer) {
+    if (buffer.native_handle() != &kEncodedFrameTag) {
+        return nullptr;
+    }
+    return static_cast<EncodedFrameBuffer*>(const_cast<webrtc::VideoFrameBuffer*>(&buffer));
+}
+
+bool EncodedFrameBuffer::IsH264Keyframe(const uint8_t* data, size_t size) {
+    for (const auto& index : webrtc::H264::FindNaluIndices(data, size)) {
+        if (index.payload_size > 0 && webrtc::H264::ParseNaluType(data[index.payload_start_offset]) == webrtc::H264::kIdr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace streamer
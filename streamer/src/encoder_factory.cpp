@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <memory>
+
+#include "glog/logging.h"
+
+#include "webrtc/common_types.h"
+#include "webrtc/modules/video_coding/codecs/h264/include/h264.h"
+#include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
+#include "webrtc/modules/video_coding/codecs/vp9/include/vp9.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+
+#include "packages/streamer/include/encoder_factory.h"
+#include "packages/streamer/include/frame_watch.h"
+#include "packages/streamer/include/passthrough_encoder.h"
+
+namespace streamer {
+
+namespace {
+    // Get the SDP name of a codec, or null if it has none
+    const char* CodecName(EncoderOptions::Codec codec) {
+        switch (codec) {
+        case EncoderOptions::VP8:
+            return cricket::kVp8CodecName;
+        case EncoderOptions::VP9:
+            return cricket::kVp9CodecName;
+        case EncoderOptions::H264:
+            return cricket::kH264CodecName;
+        default:
+            return nullptr;
+        }
+    }
+
+    // TunedEncoder applies the speed preset, thread limit and keyframe
+    // interval to the settings of a software encoder, which otherwise pick
+    // all of them themselves. The built-in encoders choose their thread
+    // count from the number of cores they are told about, so limiting
+    // threads means telling them about fewer.
+    class TunedEncoder : public webrtc::VideoEncoder {
+    public:
+        TunedEncoder(webrtc::VideoEncoder* encoder, const EncoderOptions& opts, int keyframe_interval_ms)
+            : m_encoder(encoder)
+            , m_opts(opts)
+            , m_keyframe_interval_ms(keyframe_interval_ms) {
+            CHECK_NOTNULL(encoder);
+        }
+
+        int32_t InitEncode(const webrtc::VideoCodec* codec_settings, int32_t number_of_cores, size_t max_payload_size) override {
+            CHECK_NOTNULL(codec_settings);
+            webrtc::VideoCodec settings(*codec_settings);
+            Tune(&settings);
+            if (m_opts.threads_per_encoder() > 0) {
+                number_of_cores = std::min(number_of_cores, m_opts.threads_per_encoder());
+            }
+            return m_encoder->InitEncode(&settings, number_of_cores, max_payload_size);
+        }
+
+        int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) override {
+            return m_encoder->RegisterEncodeCompleteCallback(callback);
+        }
+
+        int32_t Release() override { return m_encoder->Release(); }
+
+        int32_t Encode(const webrtc::VideoFrame& frame,
+            const webrtc::CodecSpecificInfo* codec_specific_info,
+            const std::vector<webrtc::FrameType>* frame_types) override {
+            return m_encoder->Encode(frame, codec_specific_info, frame_types);
+        }
+
+        int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override {
+            return m_encoder->SetChannelParameters(packet_loss, rtt);
+        }
+
+        int32_t SetRateAllocation(const webrtc::BitrateAllocation& allocation, uint32_t framerate) override {
+            return m_encoder->SetRateAllocation(allocation, framerate);
+        }
+
+        ScalingSettings GetScalingSettings() const override { return m_encoder->GetScalingSettings(); }
+
+        bool SupportsNativeHandle() const override { return m_encoder->SupportsNativeHandle(); }
+
+        const char* ImplementationName() const override { return m_encoder->ImplementationName(); }
+
+    private:
+        // Apply the keyframe interval and speed preset. The VP8 wrapper maps
+        // the complexity onto the libvpx cpu_used setting, -6 for low and
+        // normal and -4 for higher, and lets the encoder drop its
+        // resolution when it cannot keep up. The VP9 wrapper picks its speed
+        // from the image size alone, so only denoising, which costs a pass
+        // over every frame, can be turned off there.
+        void Tune(webrtc::VideoCodec* settings) {
+            // The encoders count the keyframe interval in frames
+            if (m_keyframe_interval_ms > 0) {
+                const int frames = std::max(1, m_keyframe_interval_ms * std::max<int>(1, settings->maxFramerate) / 1000);
+                switch (settings->codecType) {
+                case webrtc::kVideoCodecVP8:
+                    settings->VP8()->keyFrameInterval = frames;
+                    break;
+                case webrtc::kVideoCodecVP9:
+                    settings->VP9()->keyFrameInterval = frames;
+                    break;
+                case webrtc::kVideoCodecH264:
+                    settings->H264()->keyFrameInterval = frames;
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (m_opts.speed() == EncoderOptions::DEFAULT_SPEED) {
+                return;
+            }
+            const bool fastest = m_opts.speed() == EncoderOptions::FASTEST;
+            switch (settings->codecType) {
+            case webrtc::kVideoCodecVP8:
+                settings->VP8()->complexity = fastest ? webrtc::kComplexityLow : webrtc::kComplexityHigher;
+                settings->VP8()->denoisingOn = !fastest;
+                if (fastest) {
+                    settings->VP8()->automaticResizeOn = true;
+                }
+                break;
+            case webrtc::kVideoCodecVP9:
+                settings->VP9()->denoisingOn = !fastest;
+                break;
+            default:
+                // OpenH264 has no speed setting in the codec settings
+                break;
+            }
+        }
+
+        // The software encoder
+        std::unique_ptr<webrtc::VideoEncoder> m_encoder;
+
+        // The options to apply
+        EncoderOptions m_opts;
+
+        // Interval between keyframes, or zero for the encoder default
+        int m_keyframe_interval_ms;
+    };
+
+    // ReportingEncoder tells the watch of the session it encodes for once it
+    // has been fed a watched frame and has encoded it, or a later one if it
+    // dropped that one. It finds the watch from the first watched frame it
+    // is fed and keeps it, so that it stays off the shared index from then
+    // on. Our encoders deliver encoded frames from within Encode, so the
+    // watch is only ever touched on the encoder thread.
+    class ReportingEncoder : public webrtc::VideoEncoder, public webrtc::EncodedImageCallback {
+    public:
+        explicit ReportingEncoder(webrtc::VideoEncoder* encoder)
+            : m_encoder(encoder)
+            , m_callback(nullptr) {
+            CHECK_NOTNULL(encoder);
+        }
+
+        int32_t InitEncode(const webrtc::VideoCodec* codec_settings, int32_t number_of_cores, size_t max_payload_size) override {
+            return m_encoder->InitEncode(codec_settings, number_of_cores, max_payload_size);
+        }
+
+        int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) override {
+            m_callback = callback;
+            return m_encoder->RegisterEncodeCompleteCallback(callback ? this : nullptr);
+        }
+
+        int32_t Release() override { return m_encoder->Release(); }
+
+        int32_t Encode(const webrtc::VideoFrame& frame,
+            const webrtc::CodecSpecificInfo* codec_specific_info,
+            const std::vector<webrtc::FrameType>* frame_types) override {
+            const webrtc::VideoFrameBuffer* buffer = frame.video_frame_buffer().get();
+            auto watch = m_watch.lock();
+            if (!watch) {
+                watch = FrameWatch::Find(buffer);
+                m_watch = watch;
+            }
+            if (watch) {
+                watch->Fed(buffer);
+            }
+            return m_encoder->Encode(frame, codec_specific_info, frame_types);
+        }
+
+        int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override {
+            return m_encoder->SetChannelParameters(packet_loss, rtt);
+        }
+
+        int32_t SetRateAllocation(const webrtc::BitrateAllocation& allocation, uint32_t framerate) override {
+            return m_encoder->SetRateAllocation(allocation, framerate);
+        }
+
+        ScalingSettings GetScalingSettings() const override { return m_encoder->GetScalingSettings(); }
+
+        bool SupportsNativeHandle() const override { return m_encoder->SupportsNativeHandle(); }
+
+        const char* ImplementationName() const override { return m_encoder->ImplementationName(); }
+
+        Result OnEncodedImage(const webrtc::EncodedImage& image,
+            const webrtc::CodecSpecificInfo* info,
+            const webrtc::RTPFragmentationHeader* fragmentation) override {
+            const Result result = m_callback->OnEncodedImage(image, info, fragmentation);
+            if (result.error == Result::OK) {
+                if (auto watch = m_watch.lock()) {
+                    watch->Encoded();
+                }
+            }
+            return result;
+        }
+
+    private:
+        // The encoder doing the work
+        std::unique_ptr<webrtc::VideoEncoder> m_encoder;
+
+        // Where encoded frames are delivered
+        webrtc::EncodedImageCallback* m_callback;
+
+        // The watch of the session this encoder encodes for, once found
+        std::weak_ptr<FrameWatch> m_watch;
+    };
+} // namespace
+
+EncoderFactory::EncoderFactory(const EncoderOptions& opts, const LossResilienceOptions& resilience)
+    : m_opts(opts)
+    , m_resilience(resilience)
+    , m_raw_codecs(RawCodecNames(opts)) {
+    // Constrained baseline is what camera encoders produce and what every
+    // browser can decode
+    cricket::VideoCodec h264(cricket::kH264CodecName);
+    h264.SetParam(cricket::kH264FmtpProfileLevelId, "42e01f");
+    h264.SetParam(cricket::kH264FmtpLevelAsymmetryAllowed, "1");
+    h264.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+    m_codecs.push_back(h264);
+    m_codecs.push_back(cricket::VideoCodec(cricket::kVp8CodecName));
+    if (std::find(m_raw_codecs.begin(), m_raw_codecs.end(), cricket::kVp9CodecName) != m_raw_codecs.end()) {
+        m_codecs.push_back(cricket::VideoCodec(cricket::kVp9CodecName));
+    }
+
+    std::string names;
+    for (const auto& name : m_raw_codecs) {
+        names += (names.empty() ? "" : ", ") + name;
+    }
+    LOG(INFO) << "encoding raw video as " << names;
+}
+
+std::vector<std::string> EncoderFactory::RawCodecNames(const EncoderOptions& opts) {
+    std::vector<EncoderOptions::Codec> codecs;
+    for (int i = 0; i < opts.codecs_size(); i++) {
+        codecs.push_back(opts.codecs(i));
+    }
+    if (codecs.empty()) {
+        codecs = { EncoderOptions::VP8, EncoderOptions::VP9 };
+    }
+
+    std::vector<std::string> names;
+    for (auto codec : codecs) {
+        const char* name = CodecName(codec);
+        if (!name) {
+            LOG(WARNING) << "ignoring unknown video codec " << codec;
+            continue;
+        }
+        if (codec == EncoderOptions::H264 && !webrtc::H264Encoder::IsSupported()) {
+            LOG(WARNING) << "H.264 software encoder not available in this build, not offering it for raw video";
+            continue;
+        }
+        if (codec == EncoderOptions::VP9 && !webrtc::VP9Encoder::IsSupported()) {
+            LOG(WARNING) << "VP9 encoder not available in this build, not offering it";
+            continue;
+        }
+        if (std::find(names.begin(), names.end(), name) == names.end()) {
+            names.push_back(name);
+        }
+    }
+
+    // VP8 is always built in
+    if (names.empty()) {
+        names = { cricket::kVp8CodecName };
+    }
+    return names;
+}
+
+webrtc::VideoEncoder* EncoderFactory::CreateSoftwareEncoder(const cricket::VideoCodec& codec) {
+    if (std::find_if(m_raw_codecs.begin(), m_raw_codecs.end(), [&codec](const std::string& name) {
+            return cricket::CodecNamesEq(codec.name, name);
+        }) == m_raw_codecs.end()) {
+        return nullptr;
+    }
+
+    webrtc::VideoEncoder* encoder = nullptr;
+    if (cricket::CodecNamesEq(codec.name, cricket::kVp8CodecName)) {
+        encoder = webrtc::VP8Encoder::Create();
+    } else if (cricket::CodecNamesEq(codec.name, cricket::kVp9CodecName)) {
+        encoder = webrtc::VP9Encoder::Create();
+    } else if (cricket::CodecNamesEq(codec.name, cricket::kH264CodecName)) {
+        encoder = webrtc::H264Encoder::Create(codec);
+    }
+    if (!encoder) {
+        return nullptr;
+    }
+    return new TunedEncoder(encoder, m_opts, m_resilience.keyframe_interval_ms());
+}
+
+webrtc::VideoEncoder* EncoderFactory::CreateVideoEncoder(const cricket::VideoCodec& codec) {
+    std::unique_ptr<webrtc::VideoEncoder> software(CreateSoftwareEncoder(codec));
+
+    // Encoded frames only ever arrive in H.264 and VP8
+    if (cricket::CodecNamesEq(codec.name, cricket::kH264CodecName) || cricket::CodecNamesEq(codec.name, cricket::kVp8CodecName)) {
+        return new ReportingEncoder(new PassthroughEncoder(std::move(software)));
+    }
+    if (!software) {
+        return nullptr;
+    }
+    return new ReportingEncoder(software.release());
+}
+
+const std::vector<cricket::VideoCodec>& EncoderFactory::supported_codecs() const { return m_codecs; }
+
+void EncoderFactory::DestroyVideoEncoder(webrtc::VideoEncoder* encoder) { delete encoder; }
+
+} // namespace streamer
@@ -0,0 +1,161 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#include "glog/logging.h"
+
+#include "zmq.hpp"
+
+#include "packages/streamer/include/frame_dispatcher.h"
+#include "packages/streamer/include/frame_source.h"
+
+namespace streamer {
+
+FrameDispatcher::FrameDispatcher(size_t num_workers)
+    : m_cycles(0)
+    , m_polling(false)
+    , m_should_continue(true)
+    , m_workers(num_workers) {
+    CHECK_EQ(pipe2(m_wake_fds, O_NONBLOCK | O_CLOEXEC), 0) << "failed to create frame dispatcher wakeup pipe";
+
+    // launch the reactor thread
+    m_thread = std::thread(&FrameDispatcher::Loop, this);
+}
+
+FrameDispatcher::~FrameDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock(m_guard);
+        if (!m_entries.empty()) {
+            LOG(ERROR) << "frame dispatcher destroyed with " << m_entries.size() << " sources still registered";
+        }
+        m_should_continue = false;
+        Wake();
+    }
+
+    // wait for the reactor to terminate
+    m_thread.join();
+
+    close(m_wake_fds[0]);
+    close(m_wake_fds[1]);
+}
+
+void FrameDispatcher::Add(FrameSource* source) {
+    CHECK_NOTNULL(source);
+    std::lock_guard<std::mutex> lock(m_guard);
+    m_entries.push_back(Entry{ source, false });
+    Wake();
+}
+
+void FrameDispatcher::Remove(FrameSource* source) {
+    auto find = [this, source] {
+        return std::find_if(m_entries.begin(), m_entries.end(), [source](const Entry& e) { return e.source == source; });
+    };
+
+    std::unique_lock<std::mutex> lock(m_guard);
+
+    // Wait for any worker processing this source to finish
+    m_changed.wait(lock, [&] { return find() == m_entries.end() || !find()->busy; });
+    auto it = find();
+    if (it == m_entries.end()) {
+        return;
+    }
+    m_entries.erase(it);
+
+    // If the reactor is polling then its poll set may still contain the
+    // socket, so wait for it to come back around
+    if (m_polling) {
+        uint64_t cycle = m_cycles;
+        Wake();
+        m_changed.wait(lock, [&] { return m_cycles != cycle; });
+    }
+}
+
+void FrameDispatcher::Wake() {
+    char c = 0;
+    if (write(m_wake_fds[1], &c, 1) < 0 && errno != EAGAIN) {
+        PLOG(ERROR) << "failed to wake frame dispatcher";
+    }
+}
+
+void FrameDispatcher::Process(FrameSource* source) {
+    source->NextFrame();
+
+    // Make the source pollable again. The source must not be touched after
+    // this since it may be removed and destroyed as soon as we unlock.
+    {
+        std::lock_guard<std::mutex> lock(m_guard);
+        for (auto& entry : m_entries) {
+            if (entry.source == source) {
+                entry.busy = false;
+            }
+        }
+        Wake();
+    }
+    m_changed.notify_all();
+}
+
+void FrameDispatcher::Loop() {
+    std::vector<zmq::pollitem_t> items;
+    std::vector<FrameSource*> polled;
+    while (true) {
+        // Build the poll set from every source that is not being processed
+        {
+            std::lock_guard<std::mutex> lock(m_guard);
+            if (!m_should_continue) {
+                return;
+            }
+
+            items.clear();
+            polled.clear();
+            items.push_back(zmq::pollitem_t{ nullptr, m_wake_fds[0], ZMQ_POLLIN, 0 });
+            for (const auto& entry : m_entries) {
+                if (!entry.busy) {
+                    items.push_back(zmq::pollitem_t{ static_cast<void*>(entry.source->m_socket), 0, ZMQ_POLLIN, 0 });
+                    polled.push_back(entry.source);
+                }
+            }
+            m_polling = true;
+        }
+
+        try {
+            zmq::poll(items.data(), items.size(), -1);
+        } catch (const zmq::error_t& err) {
+            if (err.num() != EINTR) {
+                LOG(ERROR) << "error polling frame sockets: " << err.what();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_guard);
+            m_polling = false;
+            m_cycles++;
+
+            // Drain the wakeup pipe
+            if (items[0].revents & ZMQ_POLLIN) {
+                char buf[64];
+                while (read(m_wake_fds[0], buf, sizeof(buf)) > 0) {
+                }
+            }
+
+            // Hand every ready source to a worker. Sources removed while we
+            // were polling are skipped.
+            for (size_t i = 1; i < items.size(); i++) {
+                if (!(items[i].revents & ZMQ_POLLIN)) {
+                    continue;
+                }
+                FrameSource* source = polled[i - 1];
+                for (auto& entry : m_entries) {
+                    if (entry.source == source) {
+                        entry.busy = true;
+                        m_workers.Post([this, source] { Process(source); });
+                    }
+                }
+            }
+        }
+        m_changed.notify_all();
+    }
+}
+
+} // namespace streamer
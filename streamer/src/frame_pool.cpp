@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <mutex>
+
+#include "glog/logging.h"
+
+#include "packages/streamer/include/frame_pool.h"
+
+namespace streamer {
+
+FramePool::FramePool(const std::string& label, size_t capacity)
+    : m_label(label)
+    , m_capacity(capacity)
+    , m_stats{ 0, 0, 0, 0, 0, 0 } {
+    CHECK_GT(capacity, 0u);
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> FramePool::CreateBuffer(int width, int height) {
+    std::lock_guard<std::mutex> lock(m_guard);
+
+    // Look for a free buffer of the right size. A buffer is free when the
+    // pool holds the only reference to it.
+    size_t in_use = 0;
+    auto found = m_buffers.end();
+    auto evictable = m_buffers.end();
+    for (auto it = m_buffers.begin(); it != m_buffers.end(); ++it) {
+        if (!(*it)->HasOneRef()) {
+            in_use++;
+        } else if (found == m_buffers.end() && (*it)->width() == width && (*it)->height() == height) {
+            found = it;
+        } else if (evictable == m_buffers.end()) {
+            evictable = it;
+        }
+    }
+    m_stats.high_water = std::max(m_stats.high_water, in_use + 1);
+
+    rtc::scoped_refptr<PooledBuffer> buffer;
+    if (found != m_buffers.end()) {
+        m_stats.hits++;
+        buffer = *found;
+
+        // Keep the least recently used buffers at the front for eviction
+        m_buffers.splice(m_buffers.end(), m_buffers, found);
+        return buffer;
+    }
+
+    m_stats.misses++;
+    const int stride_y = width;
+    const int stride_uv = (width + 1) / 2;
+    buffer = new PooledBuffer(width, height, stride_y, stride_uv, stride_uv);
+    CHECK_NOTNULL(buffer.get());
+
+    // Make room by dropping the least recently used free buffer, which is of
+    // some other size, or hand out a buffer of our own if all are in use
+    if (m_buffers.size() >= m_capacity) {
+        if (evictable == m_buffers.end()) {
+            m_stats.unpooled++;
+            LOG_EVERY_N(WARNING, 100) << m_label << ": all " << m_buffers.size() << " pooled buffers are in use, allocating outside the pool";
+            return buffer;
+        }
+        m_buffers.erase(evictable);
+        m_stats.evictions++;
+    }
+    m_buffers.push_back(buffer);
+    m_stats.size = m_buffers.size();
+    return buffer;
+}
+
+FramePool::Stats FramePool::stats() {
+    std::lock_guard<std::mutex> lock(m_guard);
+    return m_stats;
+}
+
+std::ostream& operator<<(std::ostream& out, const FramePool::Stats& stats) {
+    return out << "frame pool has " << stats.size << " buffers, " << stats.hits << " hits, " << stats.misses << " misses ("
+               << stats.unpooled << " unpooled), " << stats.evictions << " evictions, high water " << stats.high_water;
+}
+
+} // namespace streamer
@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "glog/logging.h"
+
+#include "webrtc/base/timeutils.h"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/convert.h"
+#include "packages/streamer/include/encoded_frame.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/jpeg_decoder.h"
+#include "packages/streamer/include/raw_sample.h"
+#include "packages/streamer/include/shared_encoder.h"
+#include "packages/streamer/proto/stream.pb.h"
+
+namespace streamer {
+
+namespace {
+    // Number of encoded samples that can queue up on the socket
+    const int kEncodedQueueLength = 64;
+
+    // Minimum time between keyframe requests if the stream does not say
+    const int kDefaultMinKeyframeIntervalMs = 500;
+
+    // Get the registry key for a stream, which is its address and topic
+    // followed by every option except the ones each session applies for
+    // itself, so that streams which ask for the same topic in different
+    // ways get sources of their own
+    std::string RegistryKeyFor(const Stream& stream) {
+        Stream source = stream;
+        source.clear_output_width();
+        source.clear_output_height();
+        source.clear_min_bitrate_kbps();
+        source.clear_start_bitrate_kbps();
+        source.clear_max_bitrate_kbps();
+        source.clear_degradation_preference();
+        source.clear_content_hint();
+        return FrameSource::KeyFor(stream) + "\n" + source.SerializeAsString();
+    }
+} // namespace
+
+/// ScaleCache holds the raw pixels of a single frame and the converted copies
+/// made from them
+struct ScaleCache {
+    /// Pool from which converted buffers are drawn
+    std::shared_ptr<FramePool> pool;
+
+    /// Histograms owned by the source for each kind of conversion
+    LatencyHistogram* convert_latency;
+    LatencyHistogram* scale_latency;
+    LatencyHistogram* fused_latency;
+    LatencyHistogram* decode_latency;
+
+    /// Workers to spread conversion over, or null to convert on the calling
+    /// thread
+    WorkerPool* workers;
+
+    /// The source's decoder for compressed samples
+    JpegDecoder* jpeg;
+
+    /// The raw pixels, which live in the source's sample buffer. The data
+    /// pointer is cleared once the frame has been dispatched.
+    ImageView image;
+
+    /// The message holding the raw pixels, if it was taken over from the
+    /// sample so that the pixels can be passed on without copying
+    std::shared_ptr<void> owner;
+
+    /// The publisher's number for an encoded sample
+    uint64_t sequence;
+
+    /// Side channel for asking the publisher of an encoded stream for a
+    /// keyframe, or null if there is none
+    std::shared_ptr<KeyframeRequester> keyframes;
+
+    /// The image converted at its native size, if anyone needed it
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> native;
+
+    /// Map from output size to converted and rescaled buffer
+    std::map<std::pair<int, int>, rtc::scoped_refptr<webrtc::I420Buffer> > buffers;
+
+    /// The mutex protecting access to the fields above. It is held while
+    /// converting so that concurrent requests for the same size do the work
+    /// only once.
+    std::mutex guard;
+
+    /// Get the image converted at its native size. Must be called with the
+    /// guard held.
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> Native() {
+        if (!native && image.format == PixelFormat::H264) {
+            webrtc::CodecSpecificInfo info;
+            info.codecType = webrtc::kVideoCodecH264;
+            info.codecSpecific.H264.packetization_mode = webrtc::H264PacketizationMode::NonInterleaved;
+            native = new rtc::RefCountedObject<EncodedFrameBuffer>(image.data,
+                image.size,
+                image.width,
+                image.height,
+                info,
+                EncodedFrameBuffer::IsH264Keyframe(image.data, image.size),
+                sequence,
+                owner,
+                keyframes);
+        } else if (!native && owner) {
+            native = WrapI420Image(image, owner);
+        } else if (!native && image.format == PixelFormat::JPEG) {
+            native = Decoded(1);
+        } else if (!native) {
+            const int64_t start_us = rtc::TimeMicros();
+            auto buffer = pool->CreateBuffer(image.width, image.height);
+            if (!ConvertImage(image, buffer, workers)) {
+                return nullptr;
+            }
+            native = buffer;
+            convert_latency->Record(rtc::TimeMicros() - start_us);
+        }
+        return native;
+    }
+
+    /// Get the compressed image decoded at 1/SCALE_DENOM of its size. The
+    /// result is cached by size like any other. Must be called with the
+    /// guard held.
+    rtc::scoped_refptr<webrtc::I420Buffer> Decoded(int scale_denom) {
+        const int width = (image.width + scale_denom - 1) / scale_denom;
+        const int height = (image.height + scale_denom - 1) / scale_denom;
+        auto& out = buffers[std::make_pair(width, height)];
+        if (!out) {
+            const int64_t start_us = rtc::TimeMicros();
+            out = jpeg->Decode(image.data, image.size, scale_denom, pool.get());
+            if (!out) {
+                return nullptr;
+            }
+            decode_latency->Record(rtc::TimeMicros() - start_us);
+        }
+        return out;
+    }
+};
+
+//
+// Frame
+//
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> Frame::Scaled(int width, int height) const {
+    if (encoded) {
+        return encoded;
+    }
+    CHECK_NOTNULL(scaled.get());
+    std::lock_guard<std::mutex> lock(scaled->guard);
+    CHECK(scaled->image.data) << "frame used after dispatch";
+
+    // Encoded frames can only be passed on at the size they were encoded
+    if ((width == this->width && height == this->height) || scaled->image.format == PixelFormat::H264) {
+        return scaled->Native();
+    }
+
+    auto& out = scaled->buffers[std::make_pair(width, height)];
+    if (out) {
+        return out;
+    }
+
+    // Compressed images are decoded at the smallest DCT scale that still
+    // covers the output size, and scaled the rest of the way from there
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> source;
+    if (scaled->image.format == PixelFormat::JPEG && !scaled->native) {
+        const int denom = JpegDecoder::ScaleDenom(this->width, this->height, width, height);
+        source = denom == 1 ? scaled->Native() : scaled->Decoded(denom);
+        if (!source) {
+            return nullptr;
+        }
+        if (source->width() == width && source->height() == height) {
+            return source;
+        }
+    }
+
+    const int64_t start_us = rtc::TimeMicros();
+    auto buffer = scaled->pool->CreateBuffer(width, height);
+    if (source) {
+        if (!ScaleYUV(*source, buffer)) {
+            return nullptr;
+        }
+        scaled->scale_latency->Record(rtc::TimeMicros() - start_us);
+    } else if (!scaled->native && CanConvertAndScale(scaled->image, width, height)) {
+        // Rescaling an already converted image is cheaper than going back to
+        // the raw pixels, so only take the single-pass path if nobody needed
+        // the native size
+        if (!ConvertAndScaleImage(scaled->image, buffer, scaled->workers)) {
+            return nullptr;
+        }
+        scaled->fused_latency->Record(rtc::TimeMicros() - start_us);
+    } else {
+        auto native = scaled->Native();
+        if (!native) {
+            return nullptr;
+        }
+        const int64_t scale_start_us = rtc::TimeMicros();
+        if (!ScaleYUV(*native, buffer)) {
+            return nullptr;
+        }
+        scaled->scale_latency->Record(rtc::TimeMicros() - scale_start_us);
+    }
+    out = buffer;
+    return out;
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> Frame::Cropped(int crop_x, int crop_y, int crop_width, int crop_height, int width, int height) const {
+    if (encoded || (crop_x == 0 && crop_y == 0 && crop_width == this->width && crop_height == this->height)) {
+        return Scaled(width, height);
+    }
+    CHECK_NOTNULL(scaled.get());
+    std::lock_guard<std::mutex> lock(scaled->guard);
+    CHECK(scaled->image.data) << "frame used after dispatch";
+
+    auto native = scaled->Native();
+    if (!native || scaled->image.format == PixelFormat::H264) {
+        return native;
+    }
+
+    const int64_t start_us = rtc::TimeMicros();
+    auto buffer = scaled->pool->CreateBuffer(width, height);
+    buffer->CropAndScaleFrom(*native, crop_x, crop_y, crop_width, crop_height);
+    scaled->scale_latency->Record(rtc::TimeMicros() - start_us);
+    return buffer;
+}
+
+//
+// FrameSource
+//
+
+FrameSource::FrameSource(const Stream& stream, zmq::context_t* ctx, FrameDispatcher* dispatcher)
+    : m_key(KeyFor(stream))
+    , m_conflate(stream.conflate())
+    , m_max_age(stream.max_frame_age_ms())
+    , m_parallel_min_pixels(stream.parallel_convert_min_pixels())
+    , m_input_format(stream.input_format())
+    , m_superseded(0)
+    , m_stale(0)
+    , m_unwanted(0)
+    , m_socket(*ctx, ZMQ_SUB)
+    , m_pool(std::make_shared<FramePool>(m_key))
+    , m_dispatcher(dispatcher) {
+    CHECK_NOTNULL(dispatcher);
+    LOG(INFO) << "subscribing to " << m_key;
+
+    const std::chrono::milliseconds min_keyframe_interval(
+        stream.min_keyframe_interval_ms() > 0 ? stream.min_keyframe_interval_ms() : kDefaultMinKeyframeIntervalMs);
+
+    // Every access unit of an encoded stream is needed to decode the ones
+    // after it, so queue them up rather than keeping only the newest
+    if (m_input_format == Stream::H264) {
+        if (m_conflate) {
+            LOG(WARNING) << m_key << ": encoded streams cannot be conflated, ignoring conflate option";
+            m_conflate = false;
+        }
+        m_socket.setsockopt(ZMQ_RCVHWM, kEncodedQueueLength);
+        if (!stream.keyframe_request_address().empty()) {
+            m_keyframes = std::make_shared<ZmqKeyframeRequester>(ctx, stream.keyframe_request_address(), stream.topic(), min_keyframe_interval);
+        }
+        if (stream.shared_encoding_tiers_size() > 0) {
+            LOG(WARNING) << m_key << ": encoded streams are passed through as is, ignoring shared encoding tiers";
+        }
+    } else {
+        m_socket.setsockopt(ZMQ_RCVHWM, 1);
+
+        // Shared encoders are sinks like any other, which only want frames
+        // while a session is watching them
+        std::vector<EncodingTier> tiers(stream.shared_encoding_tiers().begin(), stream.shared_encoding_tiers().end());
+        std::sort(tiers.begin(), tiers.end(), [](const EncodingTier& a, const EncodingTier& b) {
+            return int64_t(a.width()) * a.height() < int64_t(b.width()) * b.height();
+        });
+        // Every tier encodes at once on a thread of its own, so they share
+        // the cores rather than each taking all of them
+        const int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        const int cores_per_tier = tiers.empty() ? cores : std::max(1, cores / static_cast<int>(tiers.size()));
+        for (const auto& tier : tiers) {
+            std::string label = m_key + " " + std::to_string(tier.width()) + "x" + std::to_string(tier.height());
+            m_shared_encoders.emplace_back(new SharedEncoder(label, tier, min_keyframe_interval, cores_per_tier));
+            m_sinks.push_back(m_shared_encoders.back().get());
+        }
+    }
+    m_socket.connect(stream.address());
+    m_socket.setsockopt(ZMQ_SUBSCRIBE, stream.topic().c_str(), stream.topic().size());
+
+    // start polling for frames
+    m_dispatcher->Add(this);
+}
+
+FrameSource::~FrameSource() {
+    LOG(INFO) << "tearing down source " << m_key;
+
+    // wait for any frame in flight and stop polling
+    m_dispatcher->Remove(this);
+}
+
+std::string FrameSource::KeyFor(const Stream& stream) { return stream.address() + "/" + stream.topic(); }
+
+void FrameSource::AddSink(FrameSink* sink) {
+    CHECK_NOTNULL(sink);
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    if (std::find(m_sinks.begin(), m_sinks.end(), sink) == m_sinks.end()) {
+        m_sinks.push_back(sink);
+    }
+}
+
+void FrameSource::RemoveSink(FrameSink* sink) {
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+}
+
+SharedEncoder* FrameSource::SharedEncoderFor(int output_width, int output_height) {
+    if (m_shared_encoders.empty()) {
+        return nullptr;
+    }
+    if (output_width <= 0 || output_height <= 0) {
+        return m_shared_encoders.back().get();
+    }
+
+    SharedEncoder* best = m_shared_encoders.front().get();
+    for (const auto& encoder : m_shared_encoders) {
+        if (encoder->width() <= output_width && encoder->height() <= output_height) {
+            best = encoder.get();
+        }
+    }
+    return best;
+}
+
+void FrameSource::NextFrame() {
+    const int64_t start_us = rtc::TimeMicros();
+
+    // The dispatcher only calls us when the socket is readable
+    if (!ReceiveSample(m_socket, &m_sample, std::chrono::milliseconds(0))) {
+        return;
+    }
+
+    // Only the newest frame matters for teleoperation, so skip over anything
+    // that queued up while we were busy with the previous frame
+    if (m_conflate) {
+        while (SampleWaiting(m_socket)) {
+            if (!ReceiveSample(m_socket, &m_sample, std::chrono::milliseconds(0))) {
+                return;
+            }
+            m_superseded++;
+        }
+    }
+
+    const int64_t received_us = rtc::TimeMicros();
+    const int64_t age_us = m_sample.age_us();
+    if (age_us >= 0) {
+        m_latency.receive.Record(age_us);
+    }
+    m_latency.parse.Record(received_us - start_us);
+
+    if (m_max_age.count() > 0 && age_us > std::chrono::microseconds(m_max_age).count()) {
+        m_stale++;
+        return;
+    }
+
+    const hal::Image& image = m_sample.metadata().image();
+    const PixelFormat format = PixelFormatFor(image.format(), m_input_format);
+    if (format == PixelFormat::Unknown) {
+        LOG(ERROR) << "expected camera sample with RGBA, luminance, YUV or JPEG format, but got " << image.format();
+        return;
+    }
+    const bool compressed = format == PixelFormat::JPEG || format == PixelFormat::H264;
+    if (!compressed && image.type() != hal::PB_UNSIGNED_BYTE) {
+        LOG(ERROR) << "expected camera sample with type unsigned byte, but got " << image.type();
+        return;
+    }
+
+    // The size of a compressed image is in its header rather than the sample
+    int src_width = image.cols();
+    int src_height = image.rows();
+    if (format == PixelFormat::JPEG) {
+        if (!m_jpeg.ReadSize(m_sample.data(), m_sample.size(), &src_width, &src_height)) {
+            return;
+        }
+    } else if (!compressed && m_sample.size() != ImageSize(format, src_width, src_height)) {
+        LOG(ERROR) << "expected " << ImageSize(format, src_width, src_height) << " bytes for " << src_width << "x" << src_height
+                   << " camera sample, but got " << m_sample.size();
+        return;
+    }
+
+    // Map the capture time onto the webrtc clock by subtracting the age of
+    // the sample at the time it was received, so that the frame timestamps
+    // reflect when the image was taken rather than when we got around to it
+    const int64_t timestamp_us = age_us >= 0 ? received_us - age_us : received_us;
+
+    // Ask every sink whether it wants this frame, and skip the conversion
+    // entirely if nobody does. Sinks cannot come or go until we dispatch.
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    m_wanted.clear();
+    for (FrameSink* sink : m_sinks) {
+        if (sink->WantsFrame(src_width, src_height, timestamp_us)) {
+            m_wanted.push_back(sink);
+        }
+    }
+    if (m_wanted.empty()) {
+        m_unwanted++;
+        return;
+    }
+
+    // Conversion happens lazily when the sinks ask for the sizes they need,
+    // reading the pixels straight from the sample buffer
+    Frame frame;
+    frame.width = src_width;
+    frame.height = src_height;
+    frame.timestamp_us = timestamp_us;
+    frame.capture_time_ns = m_sample.capture_time_ns();
+    frame.scaled = std::make_shared<ScaleCache>();
+    frame.scaled->pool = m_pool;
+    frame.scaled->convert_latency = &m_latency.convert;
+    frame.scaled->scale_latency = &m_latency.scale;
+    frame.scaled->fused_latency = &m_latency.fused;
+    frame.scaled->decode_latency = &m_latency.decode;
+    frame.scaled->jpeg = &m_jpeg;
+    frame.scaled->workers = nullptr;
+    if (m_parallel_min_pixels > 0 && int64_t(src_width) * src_height >= m_parallel_min_pixels) {
+        frame.scaled->workers = m_dispatcher->workers();
+    }
+    frame.scaled->image = ImageView{ m_sample.data(), m_sample.size(), src_width, src_height, format };
+
+    // I420 samples are already in the layout the encoder wants, so hand the
+    // message itself to the encoder rather than copying it out
+    if (format == PixelFormat::I420) {
+        frame.scaled->owner = m_sample.ReleasePayload();
+        frame.scaled->image.data = m_sample.data();
+    }
+
+    // Encoded samples go all the way to the packetizer, which may happen
+    // after the next sample arrives, so they must outlive the sample buffer
+    if (format == PixelFormat::H264) {
+        frame.scaled->sequence = m_sample.metadata().id();
+        frame.scaled->keyframes = m_keyframes;
+        frame.scaled->owner = m_sample.ReleasePayload();
+        frame.scaled->image.data = m_sample.data();
+        if (!frame.scaled->owner) {
+            auto copy = std::make_shared<std::string>(reinterpret_cast<const char*>(m_sample.data()), m_sample.size());
+            frame.scaled->image.data = reinterpret_cast<const uint8_t*>(copy->data());
+            frame.scaled->owner = copy;
+        }
+    }
+
+    // Hand the same frame to every sink that wanted it
+    const int64_t dispatch_start_us = rtc::TimeMicros();
+    for (FrameSink* sink : m_wanted) {
+        sink->OnSourceFrame(frame);
+    }
+    m_latency.dispatch.Record(rtc::TimeMicros() - dispatch_start_us);
+
+    // The sample buffer is reused for the next frame
+    std::lock_guard<std::mutex> scaled_lock(frame.scaled->guard);
+    frame.scaled->image.data = nullptr;
+}
+
+void FrameSource::PrintStats(std::ostream& out) {
+    out << m_key << ":\n";
+    out << "  receive:  " << m_latency.receive << "\n";
+    out << "  parse:    " << m_latency.parse << "\n";
+    out << "  convert:  " << m_latency.convert << "\n";
+    out << "  scale:    " << m_latency.scale << "\n";
+    out << "  fused:    " << m_latency.fused << "\n";
+    out << "  decode:   " << m_latency.decode << "\n";
+    out << "  dispatch: " << m_latency.dispatch << "\n";
+    out << "  " << m_pool->stats() << "\n";
+    out << "  dropped " << m_superseded << " superseded, " << m_stale << " stale and " << m_unwanted << " unwanted samples\n";
+    if (m_keyframes) {
+        out << "  requested " << m_keyframes->count() << " keyframes, merged " << m_keyframes->merged_count() << " more requests\n";
+    }
+    for (const auto& encoder : m_shared_encoders) {
+        encoder->PrintStats(out);
+    }
+}
+
+//
+// FrameSourceRegistry
+//
+
+void FrameSourceRegistry::PrintStats(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(m_guard);
+    for (const auto& item : m_sources) {
+        if (auto source = item.second.lock()) {
+            source->PrintStats(out);
+        }
+    }
+}
+
+FrameSourceRegistry::FrameSourceRegistry(zmq::context_t* ctx, size_t num_workers)
+    : m_ctx(ctx)
+    , m_dispatcher(num_workers) {}
+
+std::shared_ptr<FrameSource> FrameSourceRegistry::Acquire(const Stream& stream) {
+    const std::string label = FrameSource::KeyFor(stream);
+    const std::string key = RegistryKeyFor(stream);
+    bool subscribed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_guard);
+
+        // Drop entries for sources that have already been torn down
+        for (auto it = m_sources.begin(); it != m_sources.end();) {
+            if (it->second.expired()) {
+                it = m_sources.erase(it);
+            } else {
+                subscribed |= it->first.compare(0, label.size() + 1, label + "\n") == 0;
+                ++it;
+            }
+        }
+
+        auto it = m_sources.find(key);
+        if (it != m_sources.end()) {
+            if (auto source = it->second.lock()) {
+                return source;
+            }
+        }
+    }
+
+    // Connecting blocks, so build the source without holding up sessions
+    // acquiring other sources
+    if (subscribed) {
+        LOG(WARNING) << label << " already has a source with different options, creating another";
+    } else {
+        LOG(INFO) << "no source for " << label << " yet, creating new source";
+    }
+    auto created = std::make_shared<FrameSource>(stream, m_ctx, &m_dispatcher);
+
+    std::lock_guard<std::mutex> lock(m_guard);
+    auto& entry = m_sources[key];
+    if (auto source = entry.lock()) {
+        // Another session created the same source in the meantime
+        return source;
+    }
+    entry = created;
+    return created;
+}
+
+} // namespace streamer
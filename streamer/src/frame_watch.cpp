@@ -0,0 +1,153 @@
+#include <map>
+
+#include "glog/logging.h"
+
+#include "webrtc/base/callback.h"
+
+#include "packages/streamer/include/encoded_frame.h"
+#include "packages/streamer/include/frame_watch.h"
+
+namespace streamer {
+
+namespace {
+    // WatchIndex maps the buffers that sessions are watching to their
+    // watches, so that encoders can find theirs. It holds no references, and
+    // entries go when their buffers are released.
+    class WatchIndex {
+    public:
+        // Get the index shared by every watch
+        static WatchIndex* Get() {
+            static WatchIndex index;
+            return &index;
+        }
+
+        void Add(const webrtc::VideoFrameBuffer* buffer, const std::weak_ptr<FrameWatch>& watch) {
+            std::lock_guard<std::mutex> lock(m_guard);
+            m_watches[buffer] = watch;
+            m_size = m_watches.size();
+        }
+
+        void Remove(const webrtc::VideoFrameBuffer* buffer) {
+            std::lock_guard<std::mutex> lock(m_guard);
+            m_watches.erase(buffer);
+            m_size = m_watches.size();
+        }
+
+        // Get the watch of a buffer, without locking if nothing is watched
+        std::shared_ptr<FrameWatch> Find(const webrtc::VideoFrameBuffer* buffer) {
+            if (m_size.load(std::memory_order_relaxed) == 0) {
+                return nullptr;
+            }
+            std::lock_guard<std::mutex> lock(m_guard);
+            auto it = m_watches.find(buffer);
+            return it == m_watches.end() ? nullptr : it->second.lock();
+        }
+
+    private:
+        WatchIndex()
+            : m_size(0) {}
+
+        // Map from watched buffer to its watch
+        std::map<const webrtc::VideoFrameBuffer*, std::weak_ptr<FrameWatch> > m_watches;
+
+        // The number of entries in m_watches, read without the lock
+        std::atomic<size_t> m_size;
+
+        // The mutex protecting access to m_watches
+        std::mutex m_guard;
+    };
+} // namespace
+
+FrameWatch::FrameWatch(EncodedHandler handler)
+    : m_handler(std::move(handler))
+    , m_fed(false)
+    , m_armed(false) {
+    CHECK(m_handler);
+}
+
+FrameWatch::~FrameWatch() {}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> FrameWatch::Watch(const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer) {
+    CHECK(buffer);
+
+    // The buffer is known only once it exists, after its release callback
+    auto key = std::make_shared<const webrtc::VideoFrameBuffer*>(nullptr);
+    std::weak_ptr<FrameWatch> weak_watch(shared_from_this());
+    std::function<void()> released = [key, weak_watch]() {
+        WatchIndex::Get()->Remove(*key);
+        if (auto watch = weak_watch.lock()) {
+            watch->Released(*key);
+        }
+    };
+
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> unshared;
+    if (EncodedFrameBuffer* encoded = EncodedFrameBuffer::From(*buffer)) {
+        unshared = encoded->Alias(released);
+    } else {
+        unshared = new rtc::RefCountedObject<webrtc::WrappedI420Buffer>(buffer->width(),
+            buffer->height(),
+            buffer->DataY(),
+            buffer->StrideY(),
+            buffer->DataU(),
+            buffer->StrideU(),
+            buffer->DataV(),
+            buffer->StrideV(),
+            rtc::Callback0<void>([buffer, released]() { released(); }));
+    }
+    *key = unshared.get();
+
+    {
+        std::lock_guard<std::mutex> lock(m_guard);
+        m_watched.insert(*key);
+        m_armed = true;
+    }
+    WatchIndex::Get()->Add(*key, weak_watch);
+    return unshared;
+}
+
+void FrameWatch::Reset() {
+    std::lock_guard<std::mutex> lock(m_guard);
+    m_watched.clear();
+    m_fed = false;
+    m_armed = false;
+}
+
+void FrameWatch::Detach() {
+    std::lock_guard<std::mutex> lock(m_guard);
+    m_handler = nullptr;
+}
+
+void FrameWatch::Fed(const webrtc::VideoFrameBuffer* buffer) {
+    if (!m_armed) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_guard);
+    if (m_watched.count(buffer) > 0) {
+        m_fed = true;
+    }
+}
+
+void FrameWatch::Encoded() {
+    if (!m_armed) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_guard);
+    if (!m_fed) {
+        return;
+    }
+    m_watched.clear();
+    m_fed = false;
+    m_armed = false;
+    if (m_handler) {
+        m_handler();
+    }
+}
+
+std::shared_ptr<FrameWatch> FrameWatch::Find(const webrtc::VideoFrameBuffer* buffer) { return WatchIndex::Get()->Find(buffer); }
+
+void FrameWatch::Released(const webrtc::VideoFrameBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(m_guard);
+    m_watched.erase(buffer);
+}
+
+} // namespace streamer
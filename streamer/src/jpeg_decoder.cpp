@@ -0,0 +1,199 @@
+#include <csetjmp>
+#include <cstdio>
+
+#include "jpeglib.h"
+
+#include "glog/logging.h"
+
+#include "libyuv.h"
+
+#include "packages/streamer/include/convert.h"
+#include "packages/streamer/include/jpeg_decoder.h"
+
+namespace streamer {
+
+/// JpegErrorManager turns fatal libjpeg errors into a jump back to the
+/// decoder instead of exiting the process
+struct JpegErrorManager {
+    /// The libjpeg error manager, which must come first
+    jpeg_error_mgr pub;
+
+    /// Where to jump to when libjpeg reports a fatal error
+    jmp_buf jump;
+};
+
+namespace {
+    void OnError(j_common_ptr cinfo) {
+        char msg[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, msg);
+        LOG(ERROR) << "failed to decode jpeg: " << msg;
+        longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+    }
+
+    void OnMessage(j_common_ptr cinfo) {
+        char msg[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, msg);
+        LOG_EVERY_N(WARNING, 100) << "jpeg decoder: " << msg;
+    }
+
+    // Returns true if the image is YCbCr with chroma subsampled by two in
+    // both directions, which libjpeg can hand us as raw I420 planes
+    bool IsPlanar420(const jpeg_decompress_struct& cinfo) {
+        return cinfo.num_components == 3 && cinfo.jpeg_color_space == JCS_YCbCr && cinfo.comp_info[0].h_samp_factor == 2
+            && cinfo.comp_info[0].v_samp_factor == 2 && cinfo.comp_info[1].h_samp_factor == 1 && cinfo.comp_info[1].v_samp_factor == 1
+            && cinfo.comp_info[2].h_samp_factor == 1 && cinfo.comp_info[2].v_samp_factor == 1;
+    }
+} // namespace
+
+JpegDecoder::JpegDecoder()
+    : m_error(new JpegErrorManager)
+    , m_cinfo(new jpeg_decompress_struct)
+    , m_strides{ 0, 0, 0 }
+    , m_layout(Layout::Planar420)
+    , m_width(0)
+    , m_height(0) {
+    m_cinfo->err = jpeg_std_error(&m_error->pub);
+    m_error->pub.error_exit = OnError;
+    m_error->pub.output_message = OnMessage;
+    jpeg_create_decompress(m_cinfo.get());
+}
+
+JpegDecoder::~JpegDecoder() { jpeg_destroy_decompress(m_cinfo.get()); }
+
+int JpegDecoder::ScaleDenom(int src_width, int src_height, int dst_width, int dst_height) {
+    for (int denom = 8; denom > 1; denom /= 2) {
+        if ((src_width + denom - 1) / denom >= dst_width && (src_height + denom - 1) / denom >= dst_height) {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+bool JpegDecoder::ReadSize(const uint8_t* data, size_t size, int* width, int* height) {
+    jpeg_decompress_struct* cinfo = m_cinfo.get();
+    if (setjmp(m_error->jump)) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(cinfo, const_cast<uint8_t*>(data), size);
+    jpeg_read_header(cinfo, TRUE);
+    *width = cinfo->image_width;
+    *height = cinfo->image_height;
+    jpeg_abort_decompress(cinfo);
+    return true;
+}
+
+bool JpegDecoder::DecodeToScratch(const uint8_t* data, size_t size, int scale_denom) {
+    jpeg_decompress_struct* cinfo = m_cinfo.get();
+    if (setjmp(m_error->jump)) {
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(cinfo, const_cast<uint8_t*>(data), size);
+    jpeg_read_header(cinfo, TRUE);
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale_denom;
+    cinfo->dct_method = JDCT_IFAST;
+
+    if (IsPlanar420(*cinfo)) {
+        m_layout = Layout::Planar420;
+        cinfo->out_color_space = JCS_YCbCr;
+        cinfo->raw_data_out = TRUE;
+        cinfo->do_fancy_upsampling = FALSE;
+    } else if (cinfo->num_components == 1) {
+        m_layout = Layout::Gray;
+        cinfo->out_color_space = JCS_GRAYSCALE;
+    } else {
+        m_layout = Layout::RGB;
+        cinfo->out_color_space = JCS_RGB;
+    }
+
+    jpeg_start_decompress(cinfo);
+    m_width = cinfo->output_width;
+    m_height = cinfo->output_height;
+
+    if (m_layout == Layout::Planar420) {
+        // Raw data comes out one row of MCUs at a time, in whole blocks, so
+        // the planes are padded out to a multiple of the block size
+        const int block = DCTSIZE / scale_denom;
+        const int luma_lines = 2 * block;
+        const int rows = cinfo->total_iMCU_rows * luma_lines;
+        for (int i = 0; i < 3; i++) {
+            m_strides[i] = cinfo->comp_info[i].width_in_blocks * block;
+            m_planes[i].resize(m_strides[i] * (i == 0 ? rows : rows / 2));
+        }
+
+        JSAMPROW y_rows[2 * DCTSIZE];
+        JSAMPROW u_rows[DCTSIZE];
+        JSAMPROW v_rows[DCTSIZE];
+        JSAMPARRAY planes[3] = { y_rows, u_rows, v_rows };
+        while (cinfo->output_scanline < cinfo->output_height) {
+            const int line = cinfo->output_scanline;
+            for (int i = 0; i < luma_lines; i++) {
+                y_rows[i] = &m_planes[0][(line + i) * m_strides[0]];
+            }
+            for (int i = 0; i < block; i++) {
+                u_rows[i] = &m_planes[1][(line / 2 + i) * m_strides[1]];
+                v_rows[i] = &m_planes[2][(line / 2 + i) * m_strides[2]];
+            }
+            if (jpeg_read_raw_data(cinfo, planes, luma_lines) == 0) {
+                LOG(ERROR) << "jpeg ended before the last row";
+                jpeg_abort_decompress(cinfo);
+                return false;
+            }
+        }
+    } else {
+        m_strides[0] = m_width * cinfo->output_components;
+        m_planes[0].resize(m_strides[0] * m_height);
+        while (cinfo->output_scanline < cinfo->output_height) {
+            JSAMPROW row = &m_planes[0][cinfo->output_scanline * m_strides[0]];
+            if (jpeg_read_scanlines(cinfo, &row, 1) == 0) {
+                LOG(ERROR) << "jpeg ended before the last row";
+                jpeg_abort_decompress(cinfo);
+                return false;
+            }
+        }
+    }
+
+    jpeg_finish_decompress(cinfo);
+    return true;
+}
+
+rtc::scoped_refptr<webrtc::I420Buffer> JpegDecoder::Decode(const uint8_t* data, size_t size, int scale_denom, FramePool* pool) {
+    CHECK(scale_denom == 1 || scale_denom == 2 || scale_denom == 4 || scale_denom == 8) << "bad scale " << scale_denom;
+    CHECK_NOTNULL(pool);
+
+    if (!DecodeToScratch(data, size, scale_denom)) {
+        return nullptr;
+    }
+
+    auto out = pool->CreateBuffer(m_width, m_height);
+    switch (m_layout) {
+    case Layout::Planar420:
+        // Drop the block padding while copying into the pooled buffer
+        if (libyuv::I420Copy(m_planes[0].data(), m_strides[0], m_planes[1].data(), m_strides[1], m_planes[2].data(), m_strides[2],
+                out->MutableDataY(), out->StrideY(), out->MutableDataU(), out->StrideU(), out->MutableDataV(), out->StrideV(), m_width,
+                m_height)
+            != 0) {
+            LOG(ERROR) << "failed to copy decoded jpeg";
+            return nullptr;
+        }
+        break;
+    case Layout::Gray:
+    case Layout::RGB: {
+        // Subsampling other than 4:2:0 is rare enough from cameras that we
+        // let libjpeg upsample and convert from there
+        const PixelFormat format = m_layout == Layout::Gray ? PixelFormat::Gray : PixelFormat::RGB;
+        const ImageView image{ m_planes[0].data(), m_planes[0].size(), m_width, m_height, format };
+        if (!ConvertImage(image, out)) {
+            return nullptr;
+        }
+        break;
+    }
+    }
+    return out;
+}
+
+} // namespace streamer
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cmath>
+
+#include "packages/streamer/include/latency.h"
+
+namespace streamer {
+
+namespace {
+    // Get the index of the bucket for a duration in microseconds
+    int BucketFor(int64_t micros) {
+        int bucket = 0;
+        while (micros > 0 && bucket < LatencyHistogram::kNumBuckets - 1) {
+            micros >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    // Print a duration in microseconds as fractional milliseconds
+    void PrintMillis(std::ostream& out, int64_t micros) { out << (micros / 1000) << "." << (micros % 1000) / 100 << "ms"; }
+} // namespace
+
+LatencyHistogram::LatencyHistogram()
+    : m_count(0)
+    , m_sum(0)
+    , m_max(0) {
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::Record(int64_t micros) {
+    micros = std::max<int64_t>(0, micros);
+    m_buckets[BucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(micros, std::memory_order_relaxed);
+
+    int64_t prev = m_max.load(std::memory_order_relaxed);
+    while (micros > prev && !m_max.compare_exchange_weak(prev, micros, std::memory_order_relaxed)) {
+    }
+}
+
+int64_t LatencyHistogram::mean() const {
+    uint64_t n = count();
+    return n == 0 ? 0 : m_sum.load(std::memory_order_relaxed) / int64_t(n);
+}
+
+int64_t LatencyHistogram::Percentile(double p) const {
+    uint64_t n = count();
+    if (n == 0) {
+        return 0;
+    }
+
+    uint64_t target = std::max<uint64_t>(1, uint64_t(std::ceil(n * p / 100.)));
+    uint64_t seen = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(max(), i == 0 ? int64_t(0) : (int64_t(1) << i) - 1);
+        }
+    }
+    return max();
+}
+
+std::ostream& operator<<(std::ostream& out, const LatencyHistogram& hist) {
+    out << "n=" << hist.count() << " mean=";
+    PrintMillis(out, hist.mean());
+    out << " p50=";
+    PrintMillis(out, hist.Percentile(50));
+    out << " p90=";
+    PrintMillis(out, hist.Percentile(90));
+    out << " p99=";
+    PrintMillis(out, hist.Percentile(99));
+    out << " max=";
+    PrintMillis(out, hist.max());
+    return out;
+}
+
+} // namespace streamer
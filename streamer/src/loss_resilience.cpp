@@ -0,0 +1,49 @@
+#include "packages/streamer/include/loss_resilience.h"
+
+namespace streamer {
+
+namespace {
+    // Interval between keyframes in the low latency preset, unless another
+    // is given
+    const int kLowLatencyKeyframeIntervalMs = 2000;
+} // namespace
+
+const char kFlexFecFieldTrials[] = "WebRTC-FlexFEC-03-Advertised/Enabled/WebRTC-FlexFEC-03/Enabled/";
+
+LossResilienceOptions ApplyLossResiliencePreset(LossResilienceOptions opts) {
+    if (opts.preset() == LossResilienceOptions::LOW_LATENCY) {
+        opts.set_disable_nack(true);
+        opts.set_disable_rtx(true);
+        if (opts.fec() == LossResilienceOptions::DEFAULT_FEC) {
+            opts.set_fec(LossResilienceOptions::ULPFEC);
+        }
+        if (opts.keyframe_interval_ms() == 0) {
+            opts.set_keyframe_interval_ms(kLowLatencyKeyframeIntervalMs);
+        }
+    }
+    return opts;
+}
+
+VideoSdpOptions VideoSdpOptionsFor(const LossResilienceOptions& opts) {
+    // Loss resilience is negotiated in the offer. Whatever is not named here
+    // is left as webrtc offers it.
+    VideoSdpOptions sdp;
+    sdp.nack = !opts.disable_nack();
+    sdp.rtx = !opts.disable_rtx();
+    switch (opts.fec()) {
+    case LossResilienceOptions::NO_FEC:
+        sdp.fec.clear();
+        break;
+    case LossResilienceOptions::ULPFEC:
+        sdp.fec = { "red", "ulpfec" };
+        break;
+    case LossResilienceOptions::FLEXFEC:
+        sdp.fec = { "flexfec-03" };
+        break;
+    default:
+        break;
+    }
+    return sdp;
+}
+
+} // namespace streamer
@@ -0,0 +1,56 @@
+#include "webrtc/base/timeutils.h"
+
+#include "packages/streamer/include/milestones.h"
+
+namespace streamer {
+
+const char* MilestoneName(Milestone milestone) {
+    switch (milestone) {
+    case Milestone::kSessionCreated:
+        return "session created";
+    case Milestone::kOfferSent:
+        return "offer sent";
+    case Milestone::kAnswerApplied:
+        return "answer applied";
+    case Milestone::kFirstRemoteCandidate:
+        return "first remote candidate";
+    case Milestone::kIceConnected:
+        return "ICE connected";
+    case Milestone::kFirstFrameDelivered:
+        return "first frame delivered";
+    case Milestone::kFirstFrameEncoded:
+        return "first frame encoded";
+    }
+    return "unknown";
+}
+
+MilestoneTimes::MilestoneTimes()
+    : m_request_us(0)
+    , m_reported(false) {
+    for (auto& reached : m_reached_us) {
+        reached.store(-1);
+    }
+}
+
+void MilestoneTimes::Start(int64_t request_us) {
+    m_request_us = request_us;
+    for (auto& reached : m_reached_us) {
+        reached.store(-1);
+    }
+    m_reported = false;
+}
+
+bool MilestoneTimes::Record(Milestone milestone) {
+    int64_t unset = -1;
+    return m_reached_us[static_cast<int>(milestone)].compare_exchange_strong(unset, rtc::TimeMicros());
+}
+
+int64_t MilestoneTimes::elapsed_us(Milestone milestone) const {
+    const int64_t reached = m_reached_us[static_cast<int>(milestone)];
+    if (reached < 0) {
+        return -1;
+    }
+    return reached - m_request_us;
+}
+
+} // namespace streamer
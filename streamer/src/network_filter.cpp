@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "glog/logging.h"
+
+#include "webrtc/base/ipaddress.h"
+
+#include "packages/streamer/include/network_filter.h"
+
+namespace streamer {
+
+FilteredNetworkManager::FilteredNetworkManager(std::unique_ptr<rtc::NetworkManager> networks,
+    const std::vector<std::string>& interfaces,
+    bool disable_ipv6,
+    bool disable_link_local)
+    : m_networks(std::move(networks))
+    , m_interfaces(interfaces)
+    , m_disable_ipv6(disable_ipv6)
+    , m_disable_link_local(disable_link_local) {
+    CHECK_NOTNULL(m_networks.get());
+    m_networks->SignalNetworksChanged.connect(this, &FilteredNetworkManager::OnNetworksChanged);
+    m_networks->SignalError.connect(this, &FilteredNetworkManager::OnError);
+}
+
+void FilteredNetworkManager::Initialize() { m_networks->Initialize(); }
+
+void FilteredNetworkManager::StartUpdating() { m_networks->StartUpdating(); }
+
+void FilteredNetworkManager::StopUpdating() { m_networks->StopUpdating(); }
+
+void FilteredNetworkManager::GetNetworks(NetworkList* networks) const {
+    m_networks->GetNetworks(networks);
+    Filter(networks);
+}
+
+void FilteredNetworkManager::GetAnyAddressNetworks(NetworkList* networks) {
+    m_networks->GetAnyAddressNetworks(networks);
+    Filter(networks);
+}
+
+rtc::NetworkManager::EnumerationPermission FilteredNetworkManager::enumeration_permission() const {
+    return m_networks->enumeration_permission();
+}
+
+bool FilteredNetworkManager::GetDefaultLocalAddress(int family, rtc::IPAddress* ipaddr) const {
+    if (m_disable_ipv6 && family == AF_INET6) {
+        return false;
+    }
+    return m_networks->GetDefaultLocalAddress(family, ipaddr);
+}
+
+bool FilteredNetworkManager::Allowed(const rtc::Network& network) const {
+    if (!m_interfaces.empty() && std::find(m_interfaces.begin(), m_interfaces.end(), network.name()) == m_interfaces.end()) {
+        return false;
+    }
+    if (m_disable_ipv6 && network.prefix().family() == AF_INET6) {
+        return false;
+    }
+    if (m_disable_link_local && rtc::IPIsLinkLocal(network.prefix())) {
+        return false;
+    }
+    return true;
+}
+
+void FilteredNetworkManager::Filter(NetworkList* networks) const {
+    CHECK_NOTNULL(networks);
+    networks->erase(std::remove_if(networks->begin(),
+                        networks->end(),
+                        [this](const rtc::Network* network) { return !Allowed(*network); }),
+        networks->end());
+}
+
+void FilteredNetworkManager::OnNetworksChanged() {
+    NetworkList networks;
+    GetNetworks(&networks);
+    for (const rtc::Network* network : networks) {
+        LOG(INFO) << "gathering ICE candidates on " << network->ToString();
+    }
+    SignalNetworksChanged();
+}
+
+void FilteredNetworkManager::OnError() { SignalError(); }
+
+} // namespace streamer
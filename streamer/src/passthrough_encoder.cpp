@@ -0,0 +1,179 @@
+#include "glog/logging.h"
+
+#include "webrtc/base/timeutils.h"
+#include "webrtc/common_video/h264/h264_common.h"
+#include "webrtc/modules/include/module_common_types.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+#include "webrtc/modules/video_coding/include/video_error_codes.h"
+
+#include "packages/streamer/include/encoded_frame.h"
+#include "packages/streamer/include/passthrough_encoder.h"
+
+namespace streamer {
+
+namespace {
+    // How long to wait for a requested keyframe before asking again
+    const int64_t kKeyframeRetryMs = 1000;
+} // namespace
+
+//
+// PassthroughEncoder
+//
+
+PassthroughEncoder::PassthroughEncoder(std::unique_ptr<webrtc::VideoEncoder> fallback)
+    : m_fallback(std::move(fallback))
+    , m_codec_type(webrtc::kVideoCodecUnknown)
+    , m_callback(nullptr)
+    , m_waiting_for_keyframe(true)
+    , m_last_sequence(0)
+    , m_started(false)
+    , m_last_request_ms(0) {}
+
+int32_t PassthroughEncoder::InitEncode(const webrtc::VideoCodec* codec_settings, int32_t number_of_cores, size_t max_payload_size) {
+    CHECK_NOTNULL(codec_settings);
+    if (codec_settings->codecType != webrtc::kVideoCodecH264 && codec_settings->codecType != webrtc::kVideoCodecVP8) {
+        LOG(ERROR) << "passthrough encoder only supports H.264 and VP8";
+        return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+    }
+    m_codec_type = codec_settings->codecType;
+    if (m_fallback) {
+        const int32_t result = m_fallback->InitEncode(codec_settings, number_of_cores, max_payload_size);
+        if (result != WEBRTC_VIDEO_CODEC_OK) {
+            return result;
+        }
+    }
+
+    // The next frame must be a keyframe, since the decoder is starting over
+    m_waiting_for_keyframe = true;
+    m_started = false;
+    m_last_request_ms = 0;
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t PassthroughEncoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback* callback) {
+    m_callback = callback;
+    if (m_fallback) {
+        return m_fallback->RegisterEncodeCompleteCallback(callback);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t PassthroughEncoder::Release() {
+    m_callback = nullptr;
+    if (m_fallback) {
+        return m_fallback->Release();
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t PassthroughEncoder::Encode(const webrtc::VideoFrame& frame,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const std::vector<webrtc::FrameType>* frame_types) {
+    if (!m_callback) {
+        return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
+
+    EncodedFrameBuffer* encoded = EncodedFrameBuffer::From(*frame.video_frame_buffer());
+    if (!encoded && m_fallback) {
+        return m_fallback->Encode(frame, codec_specific_info, frame_types);
+    }
+    if (!encoded) {
+        LOG_EVERY_N(ERROR, 100) << "passthrough encoder received a raw frame, dropping it";
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    if (encoded->info().codecType != m_codec_type) {
+        LOG_EVERY_N(ERROR, 100) << "passthrough encoder received a frame in another codec than the one negotiated, dropping it";
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+
+    // The receiver cannot decode anything after a gap until the next
+    // keyframe, and neither can a receiver that just asked for one
+    bool wants_keyframe = false;
+    if (frame_types) {
+        for (auto type : *frame_types) {
+            wants_keyframe |= type == webrtc::kVideoFrameKey;
+        }
+    }
+    const bool gap = m_started && encoded->sequence() != m_last_sequence + 1;
+    const int64_t now_ms = rtc::TimeMillis();
+    m_started = true;
+    m_last_sequence = encoded->sequence();
+    if (encoded->keyframe()) {
+        m_waiting_for_keyframe = false;
+    } else {
+        // Ask again now and then in case the publisher missed the request
+        const bool retry = m_waiting_for_keyframe && now_ms - m_last_request_ms >= kKeyframeRetryMs;
+        if (wants_keyframe || gap || retry || m_last_request_ms == 0) {
+            m_waiting_for_keyframe = true;
+            m_last_request_ms = now_ms;
+            encoded->RequestKeyframe();
+        }
+        if (m_waiting_for_keyframe) {
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+    }
+
+    // Tell the packetizer where each NAL unit starts, skipping start codes.
+    // Only the H.264 packetizer needs this.
+    webrtc::RTPFragmentationHeader fragmentation;
+    if (m_codec_type == webrtc::kVideoCodecH264) {
+        auto nalus = webrtc::H264::FindNaluIndices(encoded->data(), encoded->size());
+        fragmentation.VerifyAndAllocateFragmentationHeader(nalus.size());
+        for (size_t i = 0; i < nalus.size(); i++) {
+            fragmentation.fragmentationOffset[i] = nalus[i].payload_start_offset;
+            fragmentation.fragmentationLength[i] = nalus[i].payload_size;
+            fragmentation.fragmentationPlType[i] = 0;
+            fragmentation.fragmentationTimeDiff[i] = 0;
+        }
+    }
+
+    // The packetizer copies the data before returning, so it is safe to
+    // point at the bytes in the frame buffer
+    webrtc::EncodedImage image(const_cast<uint8_t*>(encoded->data()), encoded->size(), encoded->size());
+    image._encodedWidth = frame.width();
+    image._encodedHeight = frame.height();
+    image._timeStamp = frame.timestamp();
+    image.ntp_time_ms_ = frame.ntp_time_ms();
+    image.capture_time_ms_ = frame.render_time_ms();
+    image.rotation_ = frame.rotation();
+    image._frameType = encoded->keyframe() ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta;
+    image._completeFrame = true;
+
+    webrtc::CodecSpecificInfo info = encoded->info();
+    const auto result
+        = m_callback->OnEncodedImage(image, &info, m_codec_type == webrtc::kVideoCodecH264 ? &fragmentation : nullptr);
+    if (result.error != webrtc::EncodedImageCallback::Result::OK) {
+        LOG_EVERY_N(WARNING, 100) << "failed to send encoded frame";
+        return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t PassthroughEncoder::SetChannelParameters(uint32_t packet_loss, int64_t rtt) {
+    if (m_fallback) {
+        return m_fallback->SetChannelParameters(packet_loss, rtt);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t PassthroughEncoder::SetRateAllocation(const webrtc::BitrateAllocation& allocation, uint32_t framerate) {
+    // Whoever encoded the frames decides the bitrate, so only the fallback
+    // encoder can follow the estimate for this peer
+    if (m_fallback) {
+        return m_fallback->SetRateAllocation(allocation, framerate);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+}
+
+webrtc::VideoEncoder::ScalingSettings PassthroughEncoder::GetScalingSettings() const {
+    if (m_fallback) {
+        return m_fallback->GetScalingSettings();
+    }
+    return ScalingSettings(false);
+}
+
+bool PassthroughEncoder::SupportsNativeHandle() const { return true; }
+
+const char* PassthroughEncoder::ImplementationName() const { return "Passthrough"; }
+
+} // namespace streamer
@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include "glog/logging.h"
+
+#include "zmq.hpp"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/raw_sample.h"
+
+namespace streamer {
+
+namespace {
+    // Discard the rest of a message whose receipt failed partway, so that
+    // the next receive starts at the beginning of a message rather than in
+    // the middle of this one
+    void DrainMessage(zmq::socket_t& socket) {
+        while (socket.getsockopt<int>(ZMQ_RCVMORE)) {
+            zmq::message_t discard;
+            if (!socket.recv(&discard, 0)) {
+                return;
+            }
+        }
+    }
+} // namespace
+
+int64_t RawSample::age_us() const {
+    if (capture_time_ns() <= 0) {
+        return -1;
+    }
+
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
+    return std::max<int64_t>(0, now.count() - capture_time_ns() / 1000);
+}
+
+std::shared_ptr<zmq::message_t> RawSample::ReleasePayload() {
+    if (!m_separate_payload) {
+        return nullptr;
+    }
+
+    // ZMQ keeps small messages inside the message itself rather than on the
+    // heap, so moving one may move the data
+    auto payload = std::make_shared<zmq::message_t>();
+    payload->move(&m_parts[2]);
+    m_separate_payload = false;
+    m_data = static_cast<const uint8_t*>(payload->data());
+    return payload;
+}
+
+bool ReceiveSample(zmq::socket_t& socket, RawSample* sample, std::chrono::milliseconds timeout) {
+    CHECK_NOTNULL(sample);
+
+    zmq::pollitem_t items[] = { { static_cast<void*>(socket), 0, ZMQ_POLLIN, 0 } };
+    if (zmq::poll(items, 1, timeout.count()) <= 0 || !(items[0].revents & ZMQ_POLLIN)) {
+        return false;
+    }
+
+    sample->m_separate_payload = false;
+
+    // Receive every frame of the message. Each frame is received into its own
+    // message so that nothing is copied.
+    size_t num_parts = 0;
+    bool more = true;
+    while (more) {
+        zmq::message_t discard;
+        zmq::message_t& part = num_parts < 3 ? sample->m_parts[num_parts] : discard;
+        if (!socket.recv(&part, 0)) {
+            if (num_parts > 0) {
+                DrainMessage(socket);
+            }
+            return false;
+        }
+        more = part.more();
+        num_parts++;
+    }
+
+    if (num_parts > 3) {
+        LOG(ERROR) << "expected at most 3 frames in camera sample message, but got " << num_parts;
+        return false;
+    }
+
+    if (num_parts == 3) {
+        // topic, metadata, raw pixels
+        zmq::message_t& header = sample->m_parts[1];
+        zmq::message_t& payload = sample->m_parts[2];
+        if (!sample->m_metadata.ParseFromArray(header.data(), header.size())) {
+            LOG(ERROR) << "failed to parse camera sample metadata";
+            return false;
+        }
+        sample->m_data = static_cast<const uint8_t*>(payload.data());
+        sample->m_size = payload.size();
+        sample->m_separate_payload = true;
+        return true;
+    }
+
+    // Legacy format, in which the pixels are embedded in the sample. The
+    // message is preceded by the topic when it has two frames.
+    zmq::message_t& msg = sample->m_parts[num_parts - 1];
+    if (!sample->m_metadata.ParseFromArray(msg.data(), msg.size())) {
+        LOG(ERROR) << "failed to parse camera sample";
+        return false;
+    }
+    const std::string& data = sample->m_metadata.image().data();
+    sample->m_data = reinterpret_cast<const uint8_t*>(data.data());
+    sample->m_size = data.size();
+    return true;
+}
+
+bool SampleWaiting(zmq::socket_t& socket) { return socket.getsockopt<int>(ZMQ_EVENTS) & ZMQ_POLLIN; }
+
+bool SendSample(zmq::socket_t& socket, const std::string& topic, const hal::CameraSample& sample, const void* pixels, size_t size) {
+    // Serialize everything except the pixels
+    hal::CameraSample metadata(sample);
+    metadata.mutable_image()->clear_data();
+    std::string header;
+    if (!metadata.SerializeToString(&header)) {
+        LOG(ERROR) << "failed to serialize camera sample metadata";
+        return false;
+    }
+
+    return socket.send(topic.data(), topic.size(), ZMQ_SNDMORE) == topic.size()
+        && socket.send(header.data(), header.size(), ZMQ_SNDMORE) == header.size() && socket.send(pixels, size, 0) == size;
+}
+
+} // namespace streamer
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include "glog/logging.h"
+
+#include "packages/streamer/include/sdp.h"
+
+namespace streamer {
+
+namespace {
+    // Payloads that protect or repair the media rather than carry it
+    const char* kAuxiliaryCodecs[] = { "red", "ulpfec", "flexfec-03", "rtx" };
+
+    std::string ToLower(std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+    // Returns true if the line starts with the prefix
+    bool HasPrefix(const std::string& line, const std::string& prefix) { return line.compare(0, prefix.size(), prefix) == 0; }
+
+    // Get the payload type of an attribute such as "a=rtpmap:96 VP8/90000",
+    // or an empty string if the line is not such an attribute
+    std::string PayloadOf(const std::string& line) {
+        for (const char* prefix : { "a=rtpmap:", "a=fmtp:", "a=rtcp-fb:" }) {
+            if (HasPrefix(line, prefix)) {
+                const size_t start = std::string(prefix).size();
+                return line.substr(start, line.find(' ', start) - start);
+            }
+        }
+        return "";
+    }
+} // namespace
+
+bool RewriteVideoSdp(std::string* sdp, const VideoSdpOptions& opts) {
+    CHECK_NOTNULL(sdp);
+
+    // Split into lines, remembering which belong to the video section
+    std::vector<std::string> lines;
+    std::istringstream in(*sdp);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        lines.push_back(line);
+    }
+
+    size_t video_begin = lines.size();
+    size_t video_end = lines.size();
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (HasPrefix(lines[i], "m=video ")) {
+            video_begin = i;
+        } else if (video_begin < lines.size() && i > video_begin && HasPrefix(lines[i], "m=")) {
+            video_end = i;
+            break;
+        }
+    }
+    if (video_begin == lines.size()) {
+        LOG(WARNING) << "no video section in SDP, not filtering codecs";
+        return false;
+    }
+
+    // Map each payload type to its codec name, and each retransmission
+    // payload type to the payload type it repairs
+    std::map<std::string, std::string> names;
+    std::map<std::string, std::string> repairs;
+    for (size_t i = video_begin; i < video_end; i++) {
+        const std::string& l = lines[i];
+        const std::string pt = PayloadOf(l);
+        if (HasPrefix(l, "a=rtpmap:")) {
+            const size_t start = l.find(' ') + 1;
+            names[pt] = ToLower(l.substr(start, l.find('/', start) - start));
+        } else if (HasPrefix(l, "a=fmtp:") && l.find("apt=") != std::string::npos) {
+            const size_t start = l.find("apt=") + 4;
+            repairs[pt] = l.substr(start, l.find_first_of(";\r ", start) - start);
+        }
+    }
+
+    // Parse the payload types offered in the media line
+    std::istringstream media(lines[video_begin]);
+    std::vector<std::string> fields;
+    std::string field;
+    while (media >> field) {
+        fields.push_back(field);
+    }
+    if (fields.size() < 4) {
+        LOG(WARNING) << "malformed video media line in SDP: " << lines[video_begin];
+        return false;
+    }
+    const std::vector<std::string> offered(fields.begin() + 3, fields.end());
+
+    // Keep the named codecs in order of preference, or every media codec if
+    // none are named, then whatever repairs or protects them
+    auto auxiliary = [&names](const std::string& pt) {
+        return std::find(std::begin(kAuxiliaryCodecs), std::end(kAuxiliaryCodecs), names[pt]) != std::end(kAuxiliaryCodecs);
+    };
+    std::vector<std::string> kept;
+    if (opts.codecs.empty()) {
+        std::copy_if(offered.begin(), offered.end(), std::back_inserter(kept), [&auxiliary](const std::string& pt) { return !auxiliary(pt); });
+    }
+    for (const auto& codec : opts.codecs) {
+        for (const auto& pt : offered) {
+            if (names[pt] == ToLower(codec)) {
+                kept.push_back(pt);
+            }
+        }
+    }
+    if (kept.empty()) {
+        LOG(WARNING) << "none of the preferred video codecs are in the SDP, not filtering codecs";
+        return false;
+    }
+    std::set<std::string> media_pts(kept.begin(), kept.end());
+    for (const auto& pt : offered) {
+        const std::string& name = names[pt];
+        const bool protects = std::find_if(opts.fec.begin(), opts.fec.end(), [&name](const std::string& fec) {
+            return ToLower(fec) == name;
+        }) != opts.fec.end();
+        const bool repairs_kept = opts.rtx && name == "rtx" && media_pts.count(repairs[pt]);
+        if (protects || repairs_kept) {
+            kept.push_back(pt);
+        }
+    }
+    const std::set<std::string> keep(kept.begin(), kept.end());
+
+    // Drop the SSRC groups of repair streams that are no longer offered, and
+    // the lines describing their SSRCs, which would otherwise point the
+    // receiver at a stream that never arrives
+    auto kept_named = [&kept, &names](const std::string& name) {
+        return std::find_if(kept.begin(), kept.end(), [&names, &name](const std::string& pt) { return names[pt] == name; }) != kept.end();
+    };
+    std::vector<std::string> dropped_groups;
+    if (!kept_named("rtx")) {
+        dropped_groups.push_back("a=ssrc-group:FID ");
+    }
+    if (!kept_named("flexfec-03")) {
+        dropped_groups.push_back("a=ssrc-group:FEC-FR ");
+    }
+    std::set<std::string> dropped_ssrcs;
+    for (size_t i = video_begin; i < video_end; i++) {
+        for (const auto& group : dropped_groups) {
+            if (HasPrefix(lines[i], group)) {
+                // The first SSRC is the media stream, the rest repair it
+                std::istringstream ssrcs(lines[i].substr(group.size()));
+                std::string ssrc;
+                ssrcs >> ssrc;
+                while (ssrcs >> ssrc) {
+                    dropped_ssrcs.insert(ssrc);
+                }
+            }
+        }
+    }
+
+    // Reassemble the SDP without the attributes of the dropped payloads
+    std::ostringstream out;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (i == video_begin) {
+            out << fields[0] << " " << fields[1] << " " << fields[2];
+            for (const auto& pt : kept) {
+                out << " " << pt;
+            }
+            out << "\r\n";
+            continue;
+        }
+        if (i > video_begin && i < video_end) {
+            const std::string pt = PayloadOf(lines[i]);
+            if (!pt.empty() && pt != "*" && !keep.count(pt)) {
+                continue;
+            }
+            if (!opts.nack && HasPrefix(lines[i], "a=rtcp-fb:") && lines[i].substr(lines[i].find(' ') + 1) == "nack") {
+                continue;
+            }
+            if (std::find_if(dropped_groups.begin(), dropped_groups.end(), [&lines, i](const std::string& group) {
+                    return HasPrefix(lines[i], group);
+                }) != dropped_groups.end()) {
+                continue;
+            }
+            if (HasPrefix(lines[i], "a=ssrc:") && dropped_ssrcs.count(lines[i].substr(7, lines[i].find(' ') - 7))) {
+                continue;
+            }
+        }
+        out << lines[i] << "\r\n";
+    }
+    *sdp = out.str();
+    return true;
+}
+
+} // namespace streamer
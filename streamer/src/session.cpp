@@ -1,10 +1,16 @@
 #include <mutex>
+#include <string>
 
 #include "glog/logging.h"
 
-#include "packages/hal/proto/camera_sample.pb.h"
-#include "packages/net/include/zmq_protobuf.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/media/base/mediaconstants.h"
+
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/sdp.h"
 #include "packages/streamer/include/session.h"
+#include "packages/streamer/include/shared_encoder.h"
+#include "packages/streamer/include/video_capturer.h"
 
 namespace streamer {
 
@@ -20,6 +26,18 @@ namespace {
         DummySetSessionDescriptionObserver() = default;
         ~DummySetSessionDescriptionObserver() = default;
     };
+
+    // Get the codec in which frames from the given source arrive encoded, or
+    // an empty string if they arrive raw
+    std::string EncodedCodecFor(const Stream& source) {
+        if (source.input_format() == Stream::H264) {
+            return cricket::kH264CodecName;
+        }
+        if (source.shared_encoding_tiers_size() > 0) {
+            return cricket::kVp8CodecName;
+        }
+        return "";
+    }
 } // anonymous namespace
 
 /// Observer routes events to their handlers
@@ -35,6 +53,21 @@ public:
     }
 
     void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState new_state) {
+        // Only capture while the peer can receive the frames
+        switch (new_state) {
+        case webrtc::PeerConnectionInterface::kIceConnectionConnected:
+        case webrtc::PeerConnectionInterface::kIceConnectionCompleted:
+            m_session->SetActive(true);
+            break;
+        case webrtc::PeerConnectionInterface::kIceConnectionDisconnected:
+        case webrtc::PeerConnectionInterface::kIceConnectionFailed:
+        case webrtc::PeerConnectionInterface::kIceConnectionClosed:
+            m_session->SetActive(false);
+            break;
+        default:
+            break;
+        }
+
         if (m_session->m_ice_connection_change_handler) {
             m_session->m_ice_connection_change_handler(new_state);
         }
@@ -81,6 +114,22 @@ public:
     }
 
     void OnSuccess(webrtc::SessionDescriptionInterface* desc) {
+        // Restrict the video codecs to the ones that suit our source, and the
+        // loss resilience to what was configured
+        std::unique_ptr<webrtc::SessionDescriptionInterface> original;
+        std::string sdp;
+        desc->ToString(&sdp);
+        if (RewriteVideoSdp(&sdp, m_session->m_sdp_options)) {
+            webrtc::SdpParseError error;
+            auto filtered = webrtc::CreateSessionDescription(desc->type(), sdp, &error);
+            if (filtered) {
+                original.reset(desc);
+                desc = filtered;
+            } else {
+                LOG(ERROR) << m_session->m_label << ": failed to parse filtered SDP: " << error.description;
+            }
+        }
+
         LOG(INFO) << m_session->m_label << ": Set local description";
         m_session->m_connection->SetLocalDescription(DummySetSessionDescriptionObserver::Create(), desc);
 
@@ -104,17 +153,51 @@ private:
     Session* m_session;
 };
 
-Session::Session(const std::string& label, zmq::context_t* ctx)
-    : m_ctx(ctx)
+Session::Session(const std::string& label, FrameSourceRegistry* sources)
+    : m_sources(sources)
     , m_observer(new Session::Observer(this))
     , m_label(label)
-    , m_connection(nullptr) {}
+    , m_connection(nullptr)
+    , m_answered(false)
+    , m_has_stream(false)
+    , m_active(false)
+    , m_shared_encoder(nullptr)
+    , m_capturer(nullptr)
+    , m_output_width(0)
+    , m_output_height(0)
+    , m_min_bitrate_kbps(0)
+    , m_start_bitrate_kbps(0)
+    , m_max_bitrate_kbps(0)
+    , m_content_hint(Stream::NO_HINT)
+    , m_degradation(Stream::DEFAULT_DEGRADATION)
+    , m_maintain_resolution(false) {
+    CHECK_NOTNULL(sources);
+    m_encoded_watch = std::make_shared<FrameWatch>([this]() { OnFrameEncoded(); });
+}
 
 Session::~Session() {
     LOG(INFO) << m_label << ": Destroying";
+
+    // Stop receiving frames before any of our members go away
+    {
+        std::lock_guard<std::mutex> lock(m_subscription_guard);
+        Unsubscribe();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_frame_guard);
+        m_capturer = nullptr;
+    }
+
+    // Encoders that outlive us must not report to us
+    m_encoded_watch->Detach();
+
+    // Tear down webrtc while our members are still alive. The capturer stops
+    // when the last reference to its track source goes away.
     if (m_connection) {
         m_connection->Close();
+        m_connection = nullptr;
     }
+    m_track = nullptr;
 }
 
 void Session::CloseConnection() {
@@ -144,6 +227,8 @@ void Session::SetRemoteDescription(const std::string& type, const std::string& s
     m_connection->SetRemoteDescription(DummySetSessionDescriptionObserver::Create(), desc);
     if (type == "offer") {
         m_connection->CreateAnswer(m_observer.get(), &m_constraints);
+    } else if (type == "answer") {
+        m_answered = true;
     }
 }
 
@@ -159,45 +244,250 @@ void Session::AddIceCandidate(const std::string& mid, int mlineindex, const std:
 
 webrtc::PeerConnectionObserver* Session::observer() { return m_observer.get(); }
 
+void Session::SetConnection(rtc::scoped_refptr<webrtc::PeerConnectionInterface> conn) {
+    m_connection = conn;
+    ApplyBitrate(true);
+}
+
+void Session::SetVideoTrack(rtc::scoped_refptr<webrtc::VideoTrackInterface> track) {
+    m_track = track;
+    ApplyContentHint();
+}
+
+void Session::ApplyContentHint() {
+    if (!m_track) {
+        return;
+    }
+
+    // This version of webrtc has no separate degradation preference. The
+    // encoder keeps the resolution for screencasts and the frame rate for
+    // everything else, and a content hint overrides whether the video counts
+    // as a screencast. The capturer reports the degradation preference as
+    // the screencast flag, so without a hint that decides. Setting a hint
+    // makes the sender reconfigure the encoder, which is how changes of
+    // preference take effect on a live session.
+    auto hint = webrtc::VideoTrackInterface::ContentHint::kNone;
+    switch (m_content_hint) {
+    case Stream::FLUID:
+        hint = webrtc::VideoTrackInterface::ContentHint::kFluid;
+        break;
+    case Stream::DETAILED:
+        hint = webrtc::VideoTrackInterface::ContentHint::kDetailed;
+        break;
+    default:
+        if (m_degradation == Stream::MAINTAIN_RESOLUTION) {
+            hint = webrtc::VideoTrackInterface::ContentHint::kDetailed;
+        } else if (m_degradation == Stream::MAINTAIN_FRAMERATE) {
+            hint = webrtc::VideoTrackInterface::ContentHint::kFluid;
+        }
+        break;
+    }
+    if ((m_content_hint == Stream::FLUID && m_degradation == Stream::MAINTAIN_RESOLUTION)
+        || (m_content_hint == Stream::DETAILED && m_degradation == Stream::MAINTAIN_FRAMERATE)) {
+        LOG(WARNING) << m_label << ": content hint disagrees with the degradation preference, the content hint wins";
+    }
+    m_track->set_content_hint(hint);
+}
+
+void Session::ApplyBitrate(bool restart) {
+    if (!m_connection) {
+        return;
+    }
+
+    webrtc::PeerConnectionInterface::BitrateParameters bitrate;
+    if (m_min_bitrate_kbps > 0) {
+        bitrate.min_bitrate_bps = rtc::Optional<int>(m_min_bitrate_kbps * 1000);
+    }
+    if (restart && m_start_bitrate_kbps > 0) {
+        bitrate.current_bitrate_bps = rtc::Optional<int>(m_start_bitrate_kbps * 1000);
+    }
+    if (m_max_bitrate_kbps > 0) {
+        bitrate.max_bitrate_bps = rtc::Optional<int>(m_max_bitrate_kbps * 1000);
+    }
+    if (!bitrate.min_bitrate_bps && !bitrate.current_bitrate_bps && !bitrate.max_bitrate_bps) {
+        return;
+    }
+
+    auto error = m_connection->SetBitrate(bitrate);
+    if (!error.ok()) {
+        LOG(ERROR) << m_label << ": failed to set bitrate: " << error.message();
+        return;
+    }
+    LOG(INFO) << m_label << ": bitrate " << m_min_bitrate_kbps << "-" << m_max_bitrate_kbps << " kbps"
+              << (restart ? ", starting at " + std::to_string(m_start_bitrate_kbps) : "");
+}
+
 void Session::Connect(const Stream& source) {
-    // Create the zmq subscriber. This can block on at least one TCP roundtrip,
-    // so do not hold the lock while this is happening.
-    auto subscriber = std::make_unique<zmq::socket_t>(*m_ctx, ZMQ_SUB);
-    subscriber->setsockopt(ZMQ_RCVHWM, 1);
-    subscriber->connect(source.address());
-    subscriber->setsockopt(ZMQ_SUBSCRIBE, source.topic().c_str(), source.topic().size());
-
-    // Take the socket guard because we are going to overwrite the socket
-    std::lock_guard<std::mutex> lock(m_socket_guard);
-
-    // This will be moved to the m_frame_socket when the current frame read is done
-    m_next_frame_socket = std::move(subscriber);
-    m_output_width = source.output_width();
-    m_output_height = source.output_height();
-}
-
-bool Session::NextFrame(hal::CameraSample& sample, int& output_width, int& output_height) {
-    // If there is a new socket waiting then overwrite the current one with
-    // that one. We do things this way to minimize the time that the lock
-    // needs to be held. This allows us to update the frame socket without
-    // ever blocking on a long operation such as polling a socket or
-    // connecting to a socket.
+    // The codec was negotiated for the first source, and encoded frames can
+    // only be passed through with the codec they arrived in
+    const std::string encoded_codec = EncodedCodecFor(source);
+    bool switched;
+    {
+        std::lock_guard<std::mutex> lock(m_frame_guard);
+        if (m_has_stream && encoded_codec != m_encoded_codec) {
+            LOG(ERROR) << m_label << ": cannot switch between video sources sent with different codecs, ignoring "
+                       << FrameSource::KeyFor(source);
+            return;
+        }
+        switched = !m_has_stream || FrameSource::KeyFor(m_stream) != FrameSource::KeyFor(source);
+        m_encoded_codec = encoded_codec;
+        m_stream = source;
+        m_has_stream = true;
+        m_output_width = source.output_width();
+        m_output_height = source.output_height();
+        m_min_bitrate_kbps = source.min_bitrate_kbps();
+        m_start_bitrate_kbps = source.start_bitrate_kbps();
+        m_max_bitrate_kbps = source.max_bitrate_kbps();
+        m_content_hint = source.content_hint();
+        m_degradation = source.degradation_preference();
+        m_maintain_resolution = m_degradation == Stream::MAINTAIN_RESOLUTION;
+    }
+    ApplyContentHint();
+
+    // The estimate for the previous source says little about what the new
+    // one needs, so start over from its start bitrate rather than ramping
+    // up slowly from wherever we were
+    ApplyBitrate(switched);
+
+    // Nothing is received or converted until the peer can receive it
+    std::lock_guard<std::mutex> lock(m_subscription_guard);
+    if (!m_active) {
+        LOG(INFO) << m_label << ": will subscribe to " << FrameSource::KeyFor(source) << " once connected";
+        return;
+    }
+    Subscribe();
+}
+
+void Session::SetActive(bool active) {
+    std::lock_guard<std::mutex> lock(m_subscription_guard);
+    if (active == m_active) {
+        return;
+    }
+    m_active = active;
+    if (active) {
+        LOG(INFO) << m_label << ": connected, starting capture";
+        Subscribe();
+    } else {
+        LOG(INFO) << m_label << ": not connected, pausing capture";
+        Unsubscribe();
+    }
+}
+
+void Session::Subscribe() {
+    Stream source;
     {
-        std::lock_guard<std::mutex> lock(m_socket_guard);
-        if (m_next_frame_socket) {
-            m_frame_socket = std::move(m_next_frame_socket);
+        std::lock_guard<std::mutex> lock(m_frame_guard);
+        if (!m_has_stream) {
+            return;
         }
+        source = m_stream;
     }
 
-    if (!net::receive(*m_frame_socket, sample, std::chrono::milliseconds(100))) {
-        LOG(WARNING) << "timed out while waiting for frame";
-        return false;
+    // Acquiring a new source subscribes to it, which can block on at least
+    // one TCP roundtrip, so do not hold the lock while this is happening.
+    auto frames = m_sources->Acquire(source);
+    SharedEncoder* shared_encoder = frames->SharedEncoderFor(source.output_width(), source.output_height());
+
+    std::shared_ptr<FrameSource> previous;
+    SharedEncoder* previous_shared_encoder;
+    {
+        std::lock_guard<std::mutex> lock(m_frame_guard);
+        previous = m_source;
+        previous_shared_encoder = m_shared_encoder;
+        m_source = frames;
+        m_shared_encoder = shared_encoder;
     }
 
-    output_width = m_output_width;
-    output_height = m_output_height;
+    // Only the output size or bitrate changed, so there is nothing to rewire
+    if (previous == frames && previous_shared_encoder == shared_encoder) {
+        return;
+    }
+
+    LOG(INFO) << m_label << ": switching video source to " << frames->key();
+    if (previous_shared_encoder) {
+        previous_shared_encoder->RemoveSink(this);
+    } else if (previous) {
+        previous->RemoveSink(this);
+    }
+    if (shared_encoder) {
+        LOG(INFO) << m_label << ": sharing the " << shared_encoder->width() << "x" << shared_encoder->height() << " encoding";
+        shared_encoder->AddSink(this);
+    } else {
+        frames->AddSink(this);
+    }
+}
+
+void Session::Unsubscribe() {
+    std::shared_ptr<FrameSource> source;
+    SharedEncoder* shared_encoder;
+    {
+        std::lock_guard<std::mutex> lock(m_frame_guard);
+        source = std::move(m_source);
+        shared_encoder = m_shared_encoder;
+        m_shared_encoder = nullptr;
+    }
+
+    // Dropping our reference tears the source down if nobody else is
+    // watching it, which closes its socket
+    if (shared_encoder) {
+        shared_encoder->RemoveSink(this);
+    } else if (source) {
+        source->RemoveSink(this);
+    }
+}
+
+void Session::AttachCapturer(VideoCapturer* capturer) {
+    std::lock_guard<std::mutex> lock(m_frame_guard);
+    m_capturer = capturer;
+}
+
+void Session::DetachCapturer(VideoCapturer* capturer) {
+    std::lock_guard<std::mutex> lock(m_frame_guard);
+    if (m_capturer == capturer) {
+        m_capturer = nullptr;
+    }
+}
+
+bool Session::WantsFrame(int width, int height, int64_t timestamp_us) {
+    std::lock_guard<std::mutex> lock(m_frame_guard);
+
+    // Encoded frames depend on the ones before them, so none can be dropped
+    // to meet the sink wants
+    if (!m_encoded_codec.empty()) {
+        return m_capturer != nullptr;
+    }
+    return m_capturer && m_capturer->WantsFrame(m_output_width, m_output_height, timestamp_us);
+}
+
+void Session::OnSourceFrame(const Frame& frame) {
+    std::lock_guard<std::mutex> lock(m_frame_guard);
+    if (m_capturer) {
+        // Watch the frames of a new request until our encoder has encoded
+        // one of them, forgetting those of the previous request
+        if (m_milestones.elapsed_us(Milestone::kFirstFrameDelivered) < 0) {
+            m_encoded_watch->Reset();
+        }
+        const bool watch = m_milestones.elapsed_us(Milestone::kFirstFrameEncoded) < 0;
+
+        const int64_t start_us = rtc::TimeMicros();
+        m_capturer->HandleFrame(frame, watch ? m_encoded_watch : nullptr);
+        const int64_t end_us = rtc::TimeMicros();
+        m_dispatch_latency.Record(end_us - start_us);
+        m_frame_age.Record(end_us - frame.timestamp_us);
+        m_milestones.Record(Milestone::kFirstFrameDelivered);
+    }
+}
+
+void Session::OnFrameEncoded() {
+    if (m_milestones.Record(Milestone::kFirstFrameEncoded) && m_first_frame_encoded_handler) {
+        m_first_frame_encoded_handler();
+    }
+}
 
-    return true;
+void Session::PrintStats(std::ostream& out) {
+    out << m_label << ":\n";
+    out << "  dispatch:  " << m_dispatch_latency << "\n";
+    out << "  frame age: " << m_frame_age << "\n";
 }
 
 //
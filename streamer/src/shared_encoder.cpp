@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "glog/logging.h"
+
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/common_types.h"
+#include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
+#include "webrtc/modules/video_coding/include/video_error_codes.h"
+
+#include "packages/streamer/include/encoded_frame.h"
+#include "packages/streamer/include/shared_encoder.h"
+
+namespace streamer {
+
+namespace {
+    // Frame rate assumed by the rate controller when the tier has no limit
+    const int kDefaultFramerate = 30;
+
+    // Largest RTP payload the encoder should plan for
+    const size_t kMaxPayloadSize = 1200;
+
+    // Highest quantizer the encoder may use, as for the built-in encoders
+    const int kMaxQp = 56;
+} // namespace
+
+//
+// PendingKeyframe
+//
+
+PendingKeyframe::PendingKeyframe(std::chrono::milliseconds min_interval)
+    : KeyframeRequester(min_interval)
+    , m_pending(false) {}
+
+bool PendingKeyframe::Send() {
+    m_pending = true;
+    return true;
+}
+
+//
+// SharedEncoder
+//
+
+SharedEncoder::SharedEncoder(const std::string& label,
+    const EncodingTier& tier,
+    std::chrono::milliseconds min_keyframe_interval,
+    int max_cores)
+    : m_label(label)
+    , m_tier(tier)
+    , m_max_cores(std::max(1, max_cores))
+    , m_failed(false)
+    , m_keyframes(std::make_shared<PendingKeyframe>(min_keyframe_interval))
+    , m_sequence(0)
+    , m_next_frame_us(0)
+    , m_encoding(nullptr)
+    , m_stopping(false)
+    , m_keyframe_count(0)
+    , m_superseded(0) {
+    CHECK_GT(tier.width(), 0) << label << ": shared encoding tier must have a width";
+    CHECK_GT(tier.height(), 0) << label << ": shared encoding tier must have a height";
+    CHECK_GT(tier.bitrate_kbps(), 0) << label << ": shared encoding tier must have a bitrate";
+    m_thread = std::thread([this] { Run(); });
+}
+
+SharedEncoder::~SharedEncoder() {
+    {
+        std::lock_guard<std::mutex> lock(m_pending_guard);
+        m_stopping = true;
+    }
+    m_pending_cond.notify_one();
+    m_thread.join();
+
+    if (m_encoder) {
+        m_encoder->Release();
+    }
+}
+
+void SharedEncoder::AddSink(FrameSink* sink) {
+    CHECK_NOTNULL(sink);
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    if (std::find(m_sinks.begin(), m_sinks.end(), sink) == m_sinks.end()) {
+        m_sinks.push_back(sink);
+    }
+
+    // The new viewer cannot decode anything until the next keyframe
+    m_keyframes->Request();
+}
+
+void SharedEncoder::RemoveSink(FrameSink* sink) {
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+}
+
+bool SharedEncoder::StartEncoder() {
+    if (m_encoder || m_failed) {
+        return !m_failed;
+    }
+
+    const int framerate = m_tier.max_framerate() > 0 ? m_tier.max_framerate() : kDefaultFramerate;
+
+    webrtc::VideoCodec codec;
+    codec.codecType = webrtc::kVideoCodecVP8;
+    codec.width = m_tier.width();
+    codec.height = m_tier.height();
+    codec.startBitrate = m_tier.bitrate_kbps();
+    codec.maxBitrate = m_tier.bitrate_kbps();
+    codec.minBitrate = m_tier.bitrate_kbps();
+    codec.targetBitrate = m_tier.bitrate_kbps();
+    codec.maxFramerate = framerate;
+    codec.qpMax = kMaxQp;
+    codec.mode = webrtc::kRealtimeVideo;
+    *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+
+    // The size is fixed by the tier, and every viewer asks for keyframes
+    // when it needs them
+    codec.VP8()->automaticResizeOn = false;
+
+    m_encoder.reset(webrtc::VP8Encoder::Create());
+    if (m_encoder->InitEncode(&codec, m_max_cores, kMaxPayloadSize) != WEBRTC_VIDEO_CODEC_OK) {
+        LOG(ERROR) << m_label << ": failed to initialize shared encoder";
+        m_encoder.reset();
+        m_failed = true;
+        return false;
+    }
+    m_encoder->RegisterEncodeCompleteCallback(this);
+
+    webrtc::BitrateAllocation allocation;
+    allocation.SetBitrate(0, 0, m_tier.bitrate_kbps() * 1000);
+    m_encoder->SetRateAllocation(allocation, framerate);
+
+    LOG(INFO) << m_label << ": started shared encoder at " << m_tier.bitrate_kbps() << " kbps";
+    return true;
+}
+
+bool SharedEncoder::WantsFrame(int width, int height, int64_t timestamp_us) {
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    if (m_tier.max_framerate() > 0 && timestamp_us < m_next_frame_us) {
+        return false;
+    }
+    for (FrameSink* sink : m_sinks) {
+        if (sink->WantsFrame(m_tier.width(), m_tier.height(), timestamp_us)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SharedEncoder::OnSourceFrame(const Frame& frame) {
+    std::unique_ptr<Pending> pending(new Pending());
+    {
+        std::lock_guard<std::mutex> lock(m_sink_guard);
+        for (FrameSink* sink : m_sinks) {
+            if (sink->WantsFrame(m_tier.width(), m_tier.height(), frame.timestamp_us)) {
+                pending->sinks.push_back(sink);
+            }
+        }
+        if (pending->sinks.empty()) {
+            return;
+        }
+
+        // Allow a quarter of the frame interval of jitter in the capture
+        // times, so that a camera publishing at exactly the tier rate is not
+        // halved
+        if (m_tier.max_framerate() > 0) {
+            const int64_t interval_us = rtc::kNumMicrosecsPerSec / m_tier.max_framerate();
+            m_next_frame_us = frame.timestamp_us + interval_us - interval_us / 4;
+        }
+    }
+
+    // The raw pixels are only valid during dispatch, so scale them now
+    pending->buffer = frame.Scaled(m_tier.width(), m_tier.height());
+    if (!pending->buffer) {
+        return;
+    }
+    pending->timestamp_us = frame.timestamp_us;
+    pending->capture_time_ns = frame.capture_time_ns;
+
+    {
+        std::lock_guard<std::mutex> lock(m_pending_guard);
+        if (m_pending) {
+            m_superseded++;
+        }
+        m_pending = std::move(pending);
+    }
+    m_pending_cond.notify_one();
+}
+
+void SharedEncoder::Run() {
+    for (;;) {
+        std::unique_ptr<Pending> pending;
+        {
+            std::unique_lock<std::mutex> lock(m_pending_guard);
+            m_pending_cond.wait(lock, [this] { return m_stopping || m_pending; });
+            if (m_stopping) {
+                return;
+            }
+            pending = std::move(m_pending);
+        }
+        if (!StartEncoder()) {
+            continue;
+        }
+
+        webrtc::VideoFrame input(pending->buffer, webrtc::kVideoRotation_0, pending->timestamp_us);
+        input.set_timestamp(static_cast<uint32_t>(pending->timestamp_us * webrtc::kVideoPayloadTypeFrequency / rtc::kNumMicrosecsPerSec));
+        std::vector<webrtc::FrameType> types{ m_keyframes->Take() ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta };
+
+        // The encoder delivers the encoded frame to OnEncodedImage before
+        // returning, which passes it on to the sinks, so the latency recorded
+        // here includes handing the frame to every session
+        const int64_t start_us = rtc::TimeMicros();
+        m_encoding = pending.get();
+        const int32_t result = m_encoder->Encode(input, nullptr, &types);
+        m_encoding = nullptr;
+        m_encode_latency.Record(rtc::TimeMicros() - start_us);
+        if (result != WEBRTC_VIDEO_CODEC_OK) {
+            LOG_EVERY_N(ERROR, 100) << m_label << ": failed to encode frame: " << result;
+        }
+    }
+}
+
+webrtc::EncodedImageCallback::Result SharedEncoder::OnEncodedImage(const webrtc::EncodedImage& image,
+    const webrtc::CodecSpecificInfo* info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+    CHECK_NOTNULL(m_encoding);
+    CHECK_NOTNULL(info);
+
+    // The encoder reuses its output buffer, while the sessions pass the frame
+    // on from their own encoder threads, so every frame gets its own copy
+    auto copy = std::make_shared<std::string>(reinterpret_cast<const char*>(image._buffer), image._length);
+    const bool keyframe = image._frameType == webrtc::kVideoFrameKey;
+    if (keyframe) {
+        m_keyframe_count++;
+    }
+
+    Frame out;
+    out.width = m_tier.width();
+    out.height = m_tier.height();
+    out.timestamp_us = m_encoding->timestamp_us;
+    out.capture_time_ns = m_encoding->capture_time_ns;
+    out.encoded = new rtc::RefCountedObject<EncodedFrameBuffer>(reinterpret_cast<const uint8_t*>(copy->data()),
+        copy->size(),
+        m_tier.width(),
+        m_tier.height(),
+        *info,
+        keyframe,
+        m_sequence++,
+        copy,
+        m_keyframes);
+
+    // Only the sinks that wanted the frame and are still attached get it
+    std::lock_guard<std::mutex> lock(m_sink_guard);
+    for (FrameSink* sink : m_encoding->sinks) {
+        if (std::find(m_sinks.begin(), m_sinks.end(), sink) != m_sinks.end()) {
+            sink->OnSourceFrame(out);
+        }
+    }
+    return Result(Result::OK, image._timeStamp);
+}
+
+void SharedEncoder::PrintStats(std::ostream& out) {
+    out << "  " << m_label << ":\n";
+    out << "    encode:   " << m_encode_latency << "\n";
+    out << "    encoded " << m_keyframe_count << " keyframes for " << m_keyframes->count() << " requests, merged "
+        << m_keyframes->merged_count() << " more, dropped " << m_superseded << " frames superseded while encoding\n";
+}
+
+} // namespace streamer
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "zmq.hpp"
 
@@ -10,11 +15,28 @@
 #include "webrtc/api/peerconnectionfactoryproxy.h"
 #include "webrtc/api/peerconnectioninterface.h"
 #include "webrtc/api/peerconnectionproxy.h"
+#include "webrtc/base/location.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/messagequeue.h"
+#include "webrtc/base/rtccertificate.h"
+#include "webrtc/base/rtccertificategenerator.h"
+#include "webrtc/base/sslidentity.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/timeutils.h"
 #include "webrtc/modules/audio_coding/codecs/builtin_audio_encoder_factory.h"
 #include "webrtc/p2p/base/basicpacketsocketfactory.h"
+#include "webrtc/p2p/base/portallocator.h"
 #include "webrtc/p2p/client/basicportallocator.h"
 #include "webrtc/pc/peerconnection.h"
-
+#include "webrtc/system_wrappers/include/field_trial_default.h"
+
+#include "packages/streamer/include/encoder_factory.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/latency.h"
+#include "packages/streamer/include/loss_resilience.h"
+#include "packages/streamer/include/milestones.h"
+#include "packages/streamer/include/network_filter.h"
+#include "packages/streamer/include/sdp.h"
 #include "packages/streamer/include/session.h"
 #include "packages/streamer/include/signaler.h"
 #include "packages/streamer/include/video_capturer.h"
@@ -23,16 +45,144 @@
 
 namespace streamer {
 
+namespace {
+    // Time allowed for an answer to arrive, unless another is given
+    const int kDefaultAnswerTimeoutS = 30;
+
+    // Message data naming the session a message is about, which may have
+    // gone away by the time the message is handled
+    typedef rtc::TypedMessageData<std::weak_ptr<Session> > SessionMessage;
+
+    // Number of candidate sets the spare allocator gathers ahead of time for
+    // the next session, unless another is given
+    const int kDefaultCandidatePoolSize = 1;
+
+    // Set the time at which a milestone was reached in a report
+    void SetMilestone(teleop::VideoMilestones* report, Milestone milestone, int64_t elapsed_us) {
+        switch (milestone) {
+        case Milestone::kSessionCreated:
+            report->set_session_created_us(elapsed_us);
+            break;
+        case Milestone::kOfferSent:
+            report->set_offer_sent_us(elapsed_us);
+            break;
+        case Milestone::kAnswerApplied:
+            report->set_answer_applied_us(elapsed_us);
+            break;
+        case Milestone::kFirstRemoteCandidate:
+            report->set_first_remote_candidate_us(elapsed_us);
+            break;
+        case Milestone::kIceConnected:
+            report->set_ice_connected_us(elapsed_us);
+            break;
+        case Milestone::kFirstFrameDelivered:
+            report->set_first_frame_delivered_us(elapsed_us);
+            break;
+        case Milestone::kFirstFrameEncoded:
+            report->set_first_frame_encoded_us(elapsed_us);
+            break;
+        }
+    }
+
+    // Interval at which the DTLS certificate is replaced, unless another is
+    // given
+    const int kDefaultCertificateRotationS = 24 * 60 * 60;
+
+    // CertificateCallback passes a generated certificate on to a handler,
+    // or null if generation failed, unless it was detached because the
+    // handler went away first. It is called on the signaling thread.
+    class CertificateCallback : public rtc::RTCCertificateGeneratorCallback {
+    public:
+        typedef std::function<void(const rtc::scoped_refptr<rtc::RTCCertificate>& certificate)> Handler;
+
+        explicit CertificateCallback(Handler handler)
+            : m_handler(handler) {}
+
+        // Stop passing on certificates
+        void Detach() { m_handler = nullptr; }
+
+        void OnSuccess(const rtc::scoped_refptr<rtc::RTCCertificate>& certificate) override {
+            if (m_handler) {
+                m_handler(certificate);
+            }
+        }
+
+        void OnFailure() override {
+            if (m_handler) {
+                m_handler(nullptr);
+            }
+        }
+
+    private:
+        // The handler to which certificates are passed, or null once detached
+        Handler m_handler;
+    };
+
+    // A TURN server with one transport
+    struct TurnRelay {
+        TURNServer server;
+        TURNServer::Transport transport;
+    };
+
+    // Get the TURN relays to configure, in order of preference, with every
+    // server that may use either UDP or TCP split into one relay for each
+    std::vector<TurnRelay> OrderTurnRelays(const google::protobuf::RepeatedPtrField<TURNServer>& servers) {
+        std::vector<TurnRelay> relays;
+        for (const auto& server : servers) {
+            if (server.transport() == TURNServer::UDP_OR_TCP) {
+                relays.push_back({ server, TURNServer::UDP });
+                relays.push_back({ server, TURNServer::TCP });
+            } else {
+                relays.push_back({ server, server.transport() });
+            }
+        }
+        std::stable_sort(relays.begin(), relays.end(), [](const TurnRelay& a, const TurnRelay& b) {
+            if (a.server.priority() != b.server.priority()) {
+                return a.server.priority() > b.server.priority();
+            }
+            return a.transport < b.transport;
+        });
+        return relays;
+    }
+
+    // Get the URL of a TURN relay
+    std::string TurnUrl(const TurnRelay& relay) {
+        switch (relay.transport) {
+        case TURNServer::UDP:
+            return "turn:" + relay.server.address() + "?transport=udp";
+        case TURNServer::TLS:
+            return "turns:" + relay.server.address() + "?transport=tcp";
+        default:
+            return "turn:" + relay.server.address() + "?transport=tcp";
+        }
+    }
+} // namespace
+
 // SignallerImpl exists to hide the signaller implementation and avoid
 // leaking voluminous webrtc headers to other files.
-class Signaler::Impl {
+class Signaler::Impl : public rtc::MessageHandler {
 public:
     Impl(Signaler* signaler, SignalerOptions opts)
         : m_signaler(signaler)
         , m_ctx(1)
-        , m_opts(opts) {
+        , m_sources(&m_ctx, opts.capture_threads())
+        , m_opts(opts)
+        , m_raw_codecs(EncoderFactory::RawCodecNames(opts.encoder()))
+        , m_resilience(ApplyLossResiliencePreset(opts.loss_resilience()))
+        , m_reaped_count(0)
+        , m_signaling_thread(rtc::Thread::Current()) {
         CHECK_NOTNULL(signaler);
 
+        // Loss resilience is negotiated in the offer, apart from FlexFEC,
+        // which webrtc only offers when asked to through a field trial
+        m_sdp_options = VideoSdpOptionsFor(m_resilience);
+        if (m_resilience.fec() == LossResilienceOptions::FLEXFEC) {
+            webrtc::field_trial::InitFieldTrialsFromString(kFlexFecFieldTrials);
+        }
+        LOG(INFO) << "loss resilience: nack " << m_sdp_options.nack << ", rtx " << m_sdp_options.rtx << ", fec "
+                  << LossResilienceOptions::Fec_Name(m_resilience.fec()) << ", keyframe interval " << m_resilience.keyframe_interval_ms()
+                  << " ms";
+
         // Add STUN servers to config
         for (const auto& item : m_opts.stun_servers()) {
             webrtc::PeerConnectionInterface::IceServer stunserver;
@@ -40,20 +190,30 @@ public:
             m_config.servers.push_back(stunserver);
         }
 
-        // Add TURN servers to config
-        for (const auto& item : m_opts.turn_servers()) {
-            std::string url = "turn:" + item.address() + "?transport=tcp";
-            LOG(INFO) << "adding turn server: " << url;
+        // Add TURN servers to config. Webrtc gives the relays decreasing
+        // priorities in the order they are listed, on top of preferring UDP
+        // relays, so ICE only settles on TCP or TLS if UDP fails.
+        for (const auto& relay : OrderTurnRelays(m_opts.turn_servers())) {
+            std::string url = TurnUrl(relay);
+            LOG(INFO) << "adding turn server: " << url << " with priority " << relay.server.priority();
 
             webrtc::PeerConnectionInterface::IceServer turnserver;
             turnserver.uri = url;
-            turnserver.username = item.username();
-            turnserver.password = item.password();
+            turnserver.username = relay.server.username();
+            turnserver.password = relay.server.password();
             turnserver.urls.push_back(url);
             turnserver.tls_cert_policy = webrtc::PeerConnectionInterface::kTlsCertPolicyInsecureNoCheck;
             m_config.servers.push_back(turnserver);
         }
 
+        // Parse the servers once, the same way every peer connection does, so
+        // that the warm allocators match the configuration of the sessions
+        // that take them over and keep their candidates
+        CHECK(webrtc::ParseIceServers(m_config.servers, &m_stun_servers, &m_turn_servers) == webrtc::RTCErrorType::NONE)
+            << "error parsing STUN or TURN servers";
+        m_config.ice_candidate_pool_size = m_opts.candidate_pool_size() > 0 ? m_opts.candidate_pool_size() : kDefaultCandidatePoolSize;
+        m_config.disable_ipv6 = m_opts.disable_ipv6();
+
         // Setup threads
         m_network_thread = rtc::Thread::CreateWithSocketServer();
         m_worker_thread = rtc::Thread::Create();
@@ -65,13 +225,49 @@ public:
             m_worker_thread.get(), // webrtc worker
             rtc::Thread::Current(), // signalling thread
             nullptr, // audio device module (optional)
-            nullptr, // video encoder factory (optional)
+            new EncoderFactory(m_opts.encoder(), m_resilience), // video encoder factory (owned by the peer factory)
             nullptr // video decoder factory (optional)
             );
         CHECK_NOTNULL(m_factory.get());
 
-        m_network_manager.reset(new rtc::BasicNetworkManager());
+        std::vector<std::string> interfaces(m_opts.network_interfaces().begin(), m_opts.network_interfaces().end());
+        m_network_manager.reset(new FilteredNetworkManager(std::unique_ptr<rtc::NetworkManager>(new rtc::BasicNetworkManager()),
+            interfaces,
+            m_opts.disable_ipv6(),
+            m_opts.disable_link_local()));
         m_socket_factory.reset(new rtc::BasicPacketSocketFactory(m_network_thread.get()));
+
+        // Start gathering candidates for the first session
+        LOG(INFO) << "UDP port range: " << m_opts.min_udp_port() << "-" << m_opts.max_udp_port();
+        m_spare_allocator = CreatePortAllocator();
+
+        // Generating a key pair for every session delays the offer, so all
+        // sessions share one that is generated in the background and
+        // replaced from time to time
+        m_certificate_generator.reset(new rtc::RTCCertificateGenerator(m_signaling_thread, m_worker_thread.get()));
+        GenerateCertificate();
+
+        // Periodically log the video pipeline latency
+        if (m_opts.stats_interval_s() > 0) {
+            m_signaling_thread->PostDelayed(RTC_FROM_HERE, m_opts.stats_interval_s() * 1000, this, MSG_EXPORT_STATS);
+        }
+    }
+
+    ~Impl() {
+        if (m_certificate_callback) {
+            m_certificate_callback->Detach();
+        }
+
+        // Closing the sessions posts messages to ourselves, so they must be
+        // gone before the messages are cleared
+        {
+            std::lock_guard<std::mutex> lock(m_session_guard);
+            m_sessions.clear();
+        }
+        m_signaling_thread->Clear(this);
+
+        // Port allocators must be destroyed on the network thread
+        m_network_thread->Invoke<void>(RTC_FROM_HERE, [this] { m_spare_allocator.reset(); });
     }
 
     void EmitMessage(const teleop::VehicleMessage& msg) {
@@ -97,26 +293,44 @@ public:
         EmitMessage(msg);
     }
 
-    void HandleVideoRequest(const std::string& conn_id, const Stream& source) {
+    void HandleVideoRequest(const std::string& conn_id, const Stream& source, int64_t request_us) {
         LOG(INFO) << "\n\nReceived VideoRequest for: " << conn_id << "\n\n\n";
 
-        auto it = m_sessions.find(conn_id);
-        if (it == m_sessions.end()) {
+        auto session = FindSession(conn_id);
+        if (!session) {
             LOG(INFO) << "no session for " << conn_id << " yet, creating new session";
-            CreateSession(conn_id, source);
+            CreateSession(conn_id, source, request_us);
         } else {
             LOG(INFO) << "session for " << conn_id << " already exists, updating video source";
-            it->second->Connect(source);
+
+            // Report whatever the previous request reached before timing
+            // this one, and start timing before the new source can deliver
+            // a frame
+            ReportMilestones(session);
+            session->milestones()->Start(request_us);
+            session->Connect(source);
         }
     }
 
-    void CreateSession(const std::string& conn_id, const Stream& source) {
+    void CreateSession(const std::string& conn_id, const Stream& source, int64_t request_us) {
         // Create the session
-        auto session = std::make_shared<Session>(conn_id, &m_ctx);
+        const int64_t start_ms = rtc::TimeMillis();
+        auto session = std::make_shared<Session>(conn_id, &m_sources);
+        std::weak_ptr<Session> weak_session(session);
+        session->milestones()->Start(request_us);
         session->Connect(source);
 
-        session->OnSDPCreated([conn_id, this](webrtc::SessionDescriptionInterface* desc) {
-            LOG(INFO) << "created offer for " << conn_id;
+        // Encoded sources can only be sent in the codec they were encoded in
+        VideoSdpOptions sdp_options(m_sdp_options);
+        if (session->encoded()) {
+            sdp_options.codecs = { session->encoded_codec() };
+        } else {
+            sdp_options.codecs = m_raw_codecs;
+        }
+        session->SetVideoSdpOptions(sdp_options);
+
+        session->OnSDPCreated([conn_id, start_ms, weak_session, this](webrtc::SessionDescriptionInterface* desc) {
+            LOG(INFO) << "created offer for " << conn_id << " in " << rtc::TimeMillis() - start_ms << " ms";
 
             // Create the SDP request
             teleop::SDPRequest offer;
@@ -130,6 +344,9 @@ public:
             }
 
             EmitSDPOffer(offer);
+            if (auto session = weak_session.lock()) {
+                session->milestones()->Record(Milestone::kOfferSent);
+            }
         });
 
         session->OnIceCandidate([conn_id, this](const webrtc::IceCandidateInterface* candidate) {
@@ -173,10 +390,33 @@ public:
             }
         });
 
+        // Failed and closed connections never recover. The session cannot be
+        // destroyed from within its own observer, so it is reaped on the next
+        // turn of the signaling thread.
+        session->OnIceConnectionChange([conn_id, weak_session, this](webrtc::PeerConnectionInterface::IceConnectionState new_state) {
+            if (new_state == webrtc::PeerConnectionInterface::kIceConnectionConnected ||
+                new_state == webrtc::PeerConnectionInterface::kIceConnectionCompleted) {
+                if (auto session = weak_session.lock()) {
+                    session->milestones()->Record(Milestone::kIceConnected);
+                }
+            }
+            if (new_state == webrtc::PeerConnectionInterface::kIceConnectionFailed ||
+                new_state == webrtc::PeerConnectionInterface::kIceConnectionClosed) {
+                LOG(INFO) << "connection " << conn_id << " failed or closed, reaping session";
+                m_signaling_thread->Post(RTC_FROM_HERE, this, MSG_REAP_SESSION, new SessionMessage(weak_session));
+            }
+        });
+
+        // The last milestone is reached on an encoder thread, and reported
+        // on the signaling thread
+        session->OnFirstFrameEncoded([weak_session, this]() {
+            m_signaling_thread->Post(RTC_FROM_HERE, this, MSG_REPORT_MILESTONES, new SessionMessage(weak_session));
+        });
+
         // Create video source. Note that CreateVideoSource below takes
         // ownership of the object allocated here.
         LOG(INFO) << "creating video source";
-        cricket::VideoCapturer* capturer = new VideoCapturer(session.get());
+        cricket::VideoCapturer* capturer = new VideoCapturer(session);
         CHECK_NOTNULL(capturer);
 
         // Configure constraints
@@ -188,38 +428,35 @@ public:
         LOG(INFO) << "creating video track";
         rtc::scoped_refptr<webrtc::VideoTrackInterface> videoTrack(
             m_factory->CreateVideoTrack(conn_id, m_factory->CreateVideoSource(capturer, nullptr)));
+        session->SetVideoTrack(videoTrack);
 
         // Create the media stream and attach track
         LOG(INFO) << "creating media stream";
         auto stream = m_factory->CreateLocalMediaStream(conn_id);
         stream->AddTrack(videoTrack);
 
-        // Set up STUN servers
-        std::set<rtc::SocketAddress> stunservers;
-        for (auto item : m_opts.stun_servers()) {
-            rtc::SocketAddress addr;
-            CHECK(addr.FromString(item.address())) << "error parsing STUN server address: " << item.address();
-            stunservers.insert(addr);
+        // Take over the allocator that has been gathering candidates
+        // since the previous session was created
+        auto port_allocator = std::move(m_spare_allocator);
+
+        // Use the shared certificate if it is ready. Otherwise webrtc
+        // generates one for this session.
+        webrtc::PeerConnectionInterface::RTCConfiguration config(m_config);
+        rtc::scoped_refptr<rtc::RTCCertificate> certificate;
+        {
+            std::lock_guard<std::mutex> lock(m_certificate_guard);
+            certificate = m_certificate;
         }
-
-        // Create a port allocator, which we use to restrict the port range
-        LOG(INFO) << "UDP port range: " << m_opts.min_udp_port() << "-" << m_opts.max_udp_port();
-        auto port_allocator = std::make_unique<cricket::BasicPortAllocator>(m_network_manager.get(), m_socket_factory.get(), stunservers);
-        port_allocator->SetPortRange(m_opts.min_udp_port(), m_opts.max_udp_port());
-
-        // Set up TURN servers
-        for (auto item : m_opts.turn_servers()) {
-            rtc::SocketAddress turnaddr;
-            CHECK(turnaddr.FromString(item.address())) << "error parsing TURN server address";
-            cricket::RelayServerConfig turnserver(turnaddr, item.username(), item.password(), cricket::PROTO_TCP);
-            port_allocator->AddTurnServer(turnserver);
-            LOG(INFO) << "added turn server: " << item.address();
+        if (certificate) {
+            config.certificates.push_back(certificate);
+        } else {
+            LOG(WARNING) << "DTLS certificate not ready yet, generating one for " << conn_id;
         }
 
         // Create the connection to the peer and add the stream
         LOG(INFO) << "creating connection";
         auto connection = m_factory->CreatePeerConnection( // peer connection
-            m_config, // configuration for the connection
+            config, // configuration for the connection
             session->constraints(), // constraints for the connection
             std::move(port_allocator), // the port allocator
             nullptr, // certificate generator
@@ -230,21 +467,32 @@ public:
 
         // Assign the connection to the session
         session->SetConnection(connection);
+        session->milestones()->Record(Milestone::kSessionCreated);
 
         // Initiate the process of creating an offer
         LOG(INFO) << "creating offer";
         session->CreateOffer();
 
+        // Start gathering candidates for the next session
+        m_spare_allocator = CreatePortAllocator();
+
         LOG(INFO) << "adding the session";
-        m_sessions[conn_id] = session;
+        {
+            std::lock_guard<std::mutex> lock(m_session_guard);
+            m_sessions[conn_id] = session;
+        }
+
+        // Give up on viewers that never answer
+        const int timeout_s = m_opts.answer_timeout_s() > 0 ? m_opts.answer_timeout_s() : kDefaultAnswerTimeoutS;
+        m_signaling_thread->PostDelayed(RTC_FROM_HERE, timeout_s * 1000, this, MSG_ANSWER_TIMEOUT, new SessionMessage(session));
 
         LOG(INFO) << "HandleVideoRequest done";
     }
 
     void HandleSDPRequest(const teleop::SDPRequest& msg) {
         LOG(INFO) << "\n\nReceived SDPRequest for: " << msg.connection_id() << "\n\n\n";
-        auto it = m_sessions.find(msg.connection_id());
-        if (it == m_sessions.end()) {
+        auto session = FindSession(msg.connection_id());
+        if (!session) {
             LOG(WARNING) << "received SDP request with unknown connection ID: " << msg.connection_id();
             return;
         }
@@ -254,13 +502,16 @@ public:
             return;
         }
 
-        it->second->SetRemoteDescription("answer", msg.sdp());
+        session->SetRemoteDescription("answer", msg.sdp());
+        if (session->answered()) {
+            session->milestones()->Record(Milestone::kAnswerApplied);
+        }
     }
 
     void HandleICECandidate(const teleop::ICECandidate& msg) {
         LOG(INFO) << "\n\nReceived ICECandidate for: " << msg.connection_id() << "\n\n\n";
-        auto it = m_sessions.find(msg.connection_id());
-        if (it == m_sessions.end()) {
+        auto session = FindSession(msg.connection_id());
+        if (!session) {
             LOG(WARNING) << "received ICE candidate with unknown connection ID: " << msg.connection_id();
             return;
         }
@@ -280,22 +531,211 @@ public:
             return;
         }
 
-        it->second->AddIceCandidate(msg.sdp_mid(), msg.sdp_mline_index(), msg.candidate());
+        session->AddIceCandidate(msg.sdp_mid(), msg.sdp_mline_index(), msg.candidate());
+        session->milestones()->Record(Milestone::kFirstRemoteCandidate);
+    }
+
+    void HandleCloseConnection(const teleop::CloseConnection& msg) {
+        LOG(INFO) << "\n\nReceived CloseConnection for: " << msg.connection_id() << "\n\n\n";
+        auto session = FindSession(msg.connection_id());
+        if (!session) {
+            LOG(WARNING) << "received close request with unknown connection ID: " << msg.connection_id();
+            return;
+        }
+
+        m_signaling_thread->Post(RTC_FROM_HERE, this, MSG_REAP_SESSION, new SessionMessage(session));
+    }
+
+    std::string DumpStats() {
+        std::ostringstream out;
+        out << "video sources:\n";
+        m_sources.PrintStats(out);
+        std::lock_guard<std::mutex> lock(m_session_guard);
+        out << "video sessions (" << m_sessions.size() << " open, " << m_reaped_count << " reaped):\n";
+        for (const auto& item : m_sessions) {
+            item.second->PrintStats(out);
+        }
+        out << "time from video request to:\n";
+        for (int i = 0; i < kNumMilestones; i++) {
+            out << "  " << MilestoneName(static_cast<Milestone>(i)) << ": " << m_milestone_latency[i] << "\n";
+        }
+        return out.str();
+    }
+
+    void OnMessage(rtc::Message* msg) override {
+        switch (msg->message_id) {
+        case MSG_EXPORT_STATS:
+            LOG(INFO) << "video pipeline latency\n" << DumpStats();
+            m_signaling_thread->PostDelayed(RTC_FROM_HERE, m_opts.stats_interval_s() * 1000, this, MSG_EXPORT_STATS);
+            break;
+        case MSG_REAP_SESSION:
+        case MSG_ANSWER_TIMEOUT: {
+            std::unique_ptr<SessionMessage> data(static_cast<SessionMessage*>(msg->pdata));
+            auto session = data->data().lock();
+            if (!session) {
+                break;
+            }
+            if (msg->message_id == MSG_ANSWER_TIMEOUT) {
+                if (session->answered()) {
+                    break;
+                }
+                LOG(WARNING) << "no answer for " << session->label() << ", reaping session";
+            }
+            ReportMilestones(session);
+            ReapSession(session);
+            break;
+        }
+        case MSG_REPORT_MILESTONES: {
+            std::unique_ptr<SessionMessage> data(static_cast<SessionMessage*>(msg->pdata));
+            if (auto session = data->data().lock()) {
+                ReportMilestones(session);
+            }
+            break;
+        }
+        case MSG_ROTATE_CERTIFICATE:
+            GenerateCertificate();
+            break;
+        }
     }
 
 private:
+    /// Messages posted to ourselves on the signaling thread
+    enum { MSG_EXPORT_STATS, MSG_REAP_SESSION, MSG_ANSWER_TIMEOUT, MSG_ROTATE_CERTIFICATE, MSG_REPORT_MILESTONES };
+
+    /// Send the milestones of the last request of a session to the backend
+    /// and add them to the aggregate histograms, unless that was done before
+    void ReportMilestones(const std::shared_ptr<Session>& session) {
+        MilestoneTimes* milestones = session->milestones();
+        if (!milestones->TakeReport()) {
+            return;
+        }
+
+        teleop::VehicleMessage msg;
+        teleop::VideoMilestones* report = msg.mutable_vehicle_status()->mutable_video_milestones();
+        report->set_connection_id(session->label());
+        std::ostringstream summary;
+        for (int i = 0; i < kNumMilestones; i++) {
+            const Milestone milestone = static_cast<Milestone>(i);
+            const int64_t elapsed_us = milestones->elapsed_us(milestone);
+            if (elapsed_us < 0) {
+                continue;
+            }
+            SetMilestone(report, milestone, elapsed_us);
+            m_milestone_latency[i].Record(elapsed_us);
+            summary << ", " << MilestoneName(milestone) << " after " << elapsed_us / 1000 << " ms";
+        }
+        LOG(INFO) << "video request for " << session->label() << summary.str();
+        EmitMessage(msg);
+    }
+
+    /// Start generating a new DTLS certificate on the worker thread. Once it
+    /// is ready, new sessions use it, and either way the next rotation is
+    /// scheduled. Certificates stay valid for two rotations, so that
+    /// sessions negotiated just before a rotation outlive it.
+    void GenerateCertificate() {
+        const int rotation_s = m_opts.certificate_rotation_s() > 0 ? m_opts.certificate_rotation_s() : kDefaultCertificateRotationS;
+        const int64_t start_ms = rtc::TimeMillis();
+        if (m_certificate_callback) {
+            m_certificate_callback->Detach();
+        }
+        m_certificate_callback = new rtc::RefCountedObject<CertificateCallback>(
+            [this, rotation_s, start_ms](const rtc::scoped_refptr<rtc::RTCCertificate>& certificate) {
+                if (certificate) {
+                    LOG(INFO) << "generated DTLS certificate in " << rtc::TimeMillis() - start_ms << " ms";
+                    std::lock_guard<std::mutex> lock(m_certificate_guard);
+                    m_certificate = certificate;
+                } else {
+                    LOG(ERROR) << "failed to generate DTLS certificate, keeping the previous one";
+                }
+                m_signaling_thread->PostDelayed(RTC_FROM_HERE, rotation_s * 1000, this, MSG_ROTATE_CERTIFICATE);
+            });
+        m_certificate_generator->GenerateCertificateAsync(rtc::KeyParams::ECDSA(rtc::EC_NIST_P256),
+            rtc::Optional<uint64_t>(2 * static_cast<uint64_t>(rotation_s) * 1000),
+            m_certificate_callback);
+    }
+
+    /// Create a port allocator within the configured port range that starts
+    /// gathering the candidate pool of a session right away
+    std::unique_ptr<cricket::BasicPortAllocator> CreatePortAllocator() {
+        std::unique_ptr<cricket::BasicPortAllocator> allocator(
+            new cricket::BasicPortAllocator(m_network_manager.get(), m_socket_factory.get()));
+        allocator->SetPortRange(m_opts.min_udp_port(), m_opts.max_udp_port());
+
+        // The same flags as the peer connection sets, which only applies
+        // them to candidates it gathers itself
+        uint32_t flags = allocator->flags() | cricket::PORTALLOCATOR_ENABLE_SHARED_SOCKET;
+        if (!m_opts.disable_ipv6()) {
+            flags |= cricket::PORTALLOCATOR_ENABLE_IPV6;
+        }
+        allocator->set_flags(flags);
+
+        m_network_thread->Invoke<void>(RTC_FROM_HERE, [this, &allocator] {
+            allocator->Initialize();
+            allocator->SetConfiguration(m_stun_servers, m_turn_servers, m_config.ice_candidate_pool_size, m_config.prune_turn_ports);
+        });
+        return allocator;
+    }
+
+    /// Remove a session, unless it has already been replaced. The session,
+    /// its peer connection, capturer and frame source subscription are torn
+    /// down once the last reference to it is dropped.
+    void ReapSession(const std::shared_ptr<Session>& session) {
+        std::lock_guard<std::mutex> lock(m_session_guard);
+        auto it = m_sessions.find(session->label());
+        if (it == m_sessions.end() || it->second != session) {
+            return;
+        }
+        m_sessions.erase(it);
+        m_reaped_count++;
+        LOG(INFO) << "reaped session " << session->label() << ", " << m_sessions.size() << " remaining";
+    }
+
+    /// Get the session for a connection ID, or null if there is none
+    std::shared_ptr<Session> FindSession(const std::string& conn_id) {
+        std::lock_guard<std::mutex> lock(m_session_guard);
+        auto it = m_sessions.find(conn_id);
+        if (it == m_sessions.end()) {
+            return nullptr;
+        }
+        return it->second;
+    }
+
     /// Pointer back to the facade
     Signaler* m_signaler;
 
     /// The zmq context for camera sample sockets
     zmq::context_t m_ctx;
 
+    /// One shared frame source per camera address and topic
+    FrameSourceRegistry m_sources;
+
     /// Options for the signaler
     SignalerOptions m_opts;
 
+    /// Codecs to offer for raw video, in order of preference
+    std::vector<std::string> m_raw_codecs;
+
+    /// Options for surviving packet loss, with the preset applied
+    LossResilienceOptions m_resilience;
+
+    /// What to offer in the video section of every SDP, apart from codecs
+    VideoSdpOptions m_sdp_options;
+
     /// Map from connection ID to session
     std::map<std::string, std::shared_ptr<Session> > m_sessions;
 
+    /// Time from the video request to each milestone, over all requests
+    LatencyHistogram m_milestone_latency[kNumMilestones];
+
+    /// Number of sessions removed so far
+    uint64_t m_reaped_count;
+
+    /// The mutex protecting access to m_sessions and m_reaped_count
+    std::mutex m_session_guard;
+
+    /// The thread on which webrtc signaling callbacks are run
+    rtc::Thread* m_signaling_thread;
+
     /// The webrtc network thread
     std::unique_ptr<rtc::Thread> m_network_thread;
 
@@ -313,6 +753,31 @@ private:
 
     /// Configuration for Session connections
     webrtc::PeerConnectionInterface::RTCConfiguration m_config;
+
+    /// The STUN servers in m_config
+    cricket::ServerAddresses m_stun_servers;
+
+    /// The TURN servers in m_config
+    std::vector<cricket::RelayServerConfig> m_turn_servers;
+
+    /// The port allocator for the next session, which is already gathering
+    /// the candidate pool. There is only this one, so a session created
+    /// right after another starts gathering from scratch.
+    std::unique_ptr<cricket::BasicPortAllocator> m_spare_allocator;
+
+    /// Generates DTLS certificates on the worker thread
+    std::unique_ptr<rtc::RTCCertificateGenerator> m_certificate_generator;
+
+    /// Receives the certificate currently being generated
+    rtc::scoped_refptr<CertificateCallback> m_certificate_callback;
+
+    /// The DTLS certificate for new sessions, or null until the first one
+    /// has been generated
+    rtc::scoped_refptr<rtc::RTCCertificate> m_certificate;
+
+    /// The mutex protecting access to m_certificate, which is replaced on
+    /// the signaling thread and read when sessions are created
+    std::mutex m_certificate_guard;
 };
 
 //
@@ -328,9 +793,9 @@ Signaler::Signaler(const SignalerOptions& opts)
 
 Signaler::~Signaler() = default;
 
-void Signaler::HandleVideoRequest(const std::string& conn_id, const Stream& source) {
+void Signaler::HandleVideoRequest(const std::string& conn_id, const Stream& source, int64_t request_us) {
     // defer to implementation
-    m_impl->HandleVideoRequest(conn_id, source);
+    m_impl->HandleVideoRequest(conn_id, source, request_us);
 }
 
 void Signaler::HandleSDPRequest(const teleop::SDPRequest& msg) {
@@ -343,4 +808,14 @@ void Signaler::HandleICECandidate(const teleop::ICECandidate& msg) {
     m_impl->HandleICECandidate(msg);
 }
 
+void Signaler::HandleCloseConnection(const teleop::CloseConnection& msg) {
+    // defer to implementation
+    m_impl->HandleCloseConnection(msg);
+}
+
+std::string Signaler::DumpStats() {
+    // defer to implementation
+    return m_impl->DumpStats();
+}
+
 } // namespace scy
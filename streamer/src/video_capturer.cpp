@@ -1,7 +1,9 @@
+#include <algorithm>
+
 #include "glog/logging.h"
 
-#include "libyuv.h"
-#include "webrtc/common_video/libyuv/include/webrtc_libyuv.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
 
 #include "packages/streamer/include/session.h"
 #include "packages/streamer/include/video_capturer.h"
@@ -10,74 +12,20 @@
 namespace streamer {
 
 namespace {
-    bool ConvertToYUV(const hal::Image& in, uint32_t fourcc, int depth, webrtc::I420Buffer* out) {
-        CHECK_GT(in.cols(), 0u);
-        CHECK_GT(in.rows(), 0u);
-        CHECK_EQ(in.data().size(), size_t(in.cols() * in.rows() * depth));
-
-        const uint8_t* src_frame = reinterpret_cast<const uint8_t*>(in.data().data());
-        CHECK_NOTNULL(src_frame);
-
-        // Convert frame from RGBA to YUV
-        // Use libyuv directly since WebRTC wrappers don't support RGBA.
-        if (libyuv::ConvertToI420( // params for conversion
-                src_frame, // input frame
-                in.data().size(), // input size
-                out->MutableDataY(), // output Y plane
-                out->StrideY(), // output Y stride
-                out->MutableDataU(), // output U plane
-                out->StrideU(), // output U stride
-                out->MutableDataV(), // output V plane
-                out->StrideV(), // output V stride
-                0, // no cropping in x
-                0, // no cropping in y
-                in.cols(), // input width
-                in.rows(), // input height
-                in.cols(), // output width (we are not scaling here)
-                in.rows(), // output height (we are not scaling here)
-                libyuv::kRotate0, // no rotation
-                fourcc)
-            != 0) {
-            LOG(ERROR) << "failed to convert frame to I420";
-            return false;
-        }
-
-        return true;
-    }
-
-    bool ConvertGrayToYUV(const hal::Image& in, webrtc::I420Buffer* out) {
-        CHECK_GT(in.cols(), 0);
-        CHECK_GT(in.rows(), 0);
-        CHECK_EQ(in.data().size(), size_t(in.cols() * in.rows()));
-
-        const uint8_t* src_frame = reinterpret_cast<const uint8_t*>(in.data().data());
-        CHECK_NOTNULL(src_frame);
-
-        // Convert frame from RGBA to YUV
-        // Use libyuv directly since WebRTC wrappers don't support RGBA.
-        if (libyuv::I400ToI420( // params for conversion
-                src_frame, // input Y plane
-                in.cols(), // input Y stride
-                out->MutableDataY(), // output Y plane
-                out->StrideY(), // output Y stride
-                out->MutableDataU(), // output U plane
-                out->StrideU(), // output U stride
-                out->MutableDataV(), // output V plane
-                out->StrideV(), // output V stride
-                in.cols(), // input width
-                in.rows() // input height
-                )
-            != 0) {
-            LOG(ERROR) << "failed to convert frame to I420";
-            return false;
-        }
-
-        return true;
-    }
+    // Milliseconds between the NTP epoch (1900) and the unix epoch (1970)
+    const int64_t kNtpJan1970Ms = 2208988800000LL;
 } // namespace
 
-VideoCapturer::VideoCapturer(Session* session)
-    : session_(session) {}
+VideoCapturer::VideoCapturer(std::weak_ptr<Session> session)
+    : session_(std::move(session))
+    , output_width_(0)
+    , output_height_(0)
+    , adapted_width_(0)
+    , adapted_height_(0)
+    , crop_x_(0)
+    , crop_y_(0)
+    , crop_width_(0)
+    , crop_height_(0) {}
 
 VideoCapturer::~VideoCapturer() {}
 
@@ -91,15 +39,11 @@ cricket::CaptureState VideoCapturer::Start(const cricket::VideoFormat& format) {
     format_ = format;
     SetCaptureFormat(&format);
 
-    // check that we're not already running
-    if (thread_.joinable()) {
-        LOG(FATAL) << "VideoCapturer::Start called when video capturer is already running";
+    // start receiving frames from the session
+    if (auto session = session_.lock()) {
+        session->AttachCapturer(this);
     }
 
-    // launch a new thread that polls for frames
-    should_continue_ = true;
-    thread_ = std::thread(&VideoCapturer::Loop, this);
-
     return cricket::CS_RUNNING;
 }
 
@@ -110,112 +54,59 @@ void VideoCapturer::Stop() {
         return;
     }
 
-    // signal the thread to stop
-    should_continue_ = false;
-
-    // wait for the thread to terminate
-    thread_.join();
+    // stop receiving frames from the session, unless it is already gone
+    if (auto session = session_.lock()) {
+        session->DetachCapturer(this);
+    }
 
     SetCaptureFormat(nullptr);
     SetCaptureState(cricket::CS_STOPPED);
 }
 
-void VideoCapturer::Loop() {
-    while (should_continue_) {
-        NextFrame();
-    }
+bool VideoCapturer::WantsFrame(int output_width, int output_height, int64_t timestamp_us) {
+    // let the adapter apply the max pixel count, target pixel count and max
+    // framerate requested by the sinks. This must happen before conversion
+    // so that frames the encoder would drop never get converted.
+    int64_t translated_camera_time_us;
+    output_width_ = output_width;
+    output_height_ = output_height;
+    return AdaptFrame(output_width, output_height, timestamp_us, rtc::TimeMicros(), &adapted_width_, &adapted_height_, &crop_width_,
+        &crop_height_, &crop_x_, &crop_y_, &translated_camera_time_us);
 }
 
-void VideoCapturer::NextFrame() {
-    int output_width;
-    int output_height;
-    if (!session_->NextFrame(sample_, output_width, output_height)) {
-        LOG(WARNING) << "no frame available";
-        return;
-    }
-
-    if (sample_.image().type() != hal::PB_UNSIGNED_BYTE) {
-        LOG(ERROR) << "expected camera sample with type unsigned byte, but got " << sample_.image().type();
+void VideoCapturer::HandleFrame(const Frame& in, const std::shared_ptr<FrameWatch>& watch) {
+    // the adapter crops in output coordinates, to keep the aspect ratio when
+    // it changes resolution, so map the crop back onto the camera image
+    const int crop_x = output_width_ > 0 ? static_cast<int>(int64_t(crop_x_) * in.width / output_width_) : 0;
+    const int crop_y = output_height_ > 0 ? static_cast<int>(int64_t(crop_y_) * in.height / output_height_) : 0;
+    const int crop_width = output_width_ > 0 ? static_cast<int>(int64_t(crop_width_) * in.width / output_width_) : in.width;
+    const int crop_height = output_height_ > 0 ? static_cast<int>(int64_t(crop_height_) * in.height / output_height_) : in.height;
+
+    // scale the frame to the adapted size. Uncropped frames are shared with
+    // every other session that wants this source at the same size.
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> frame = in.Cropped(crop_x,
+        crop_y,
+        std::min(crop_width, in.width - crop_x),
+        std::min(crop_height, in.height - crop_y),
+        adapted_width_,
+        adapted_height_);
+    if (!frame) {
         return;
     }
 
-    const int src_width = sample_.image().cols();
-    const int src_height = sample_.image().rows();
-
-    // Allocate a new buffer if necessary
-    if (!unscaled_ || src_width != unscaled_->width() || src_height != unscaled_->height()) {
-        const int stride_y = src_width;
-        const int stride_uv = (src_width + 1) / 2;
-        unscaled_ = webrtc::I420Buffer::Create(src_width, src_height, stride_y, stride_uv, stride_uv);
-        CHECK_NOTNULL(unscaled_.get());
+    // the frame may be shared with other sessions, whose encoders must not
+    // be mistaken for ours
+    if (watch) {
+        frame = watch->Watch(frame);
     }
 
-    // Allocate a new buffer if necessary
-    if (!scaled_ || output_width != scaled_->width() || output_height != scaled_->height()) {
-        const int stride_y = output_width;
-        const int stride_uv = (output_width + 1) / 2;
-        scaled_ = webrtc::I420Buffer::Create(output_width, output_height, stride_y, stride_uv, stride_uv);
-        CHECK_NOTNULL(scaled_.get());
+    // stamp the frame with the time at which the camera captured it
+    webrtc::VideoFrame video_frame(frame, 0, in.timestamp_us / rtc::kNumMicrosecsPerMillisec, webrtc::kVideoRotation_0);
+    if (in.capture_time_ns > 0) {
+        video_frame.set_ntp_time_ms(in.capture_time_ns / rtc::kNumNanosecsPerMillisec + kNtpJan1970Ms);
     }
 
-    switch (sample_.image().format()) {
-    case hal::PB_LUMINANCE:
-        LOG_EVERY_N(INFO, 100) << "received a " << src_width << "x" << src_height << " grayscale frame";
-        if (!ConvertGrayToYUV(sample_.image(), unscaled_)) {
-            return;
-        }
-        break;
-    case hal::PB_RGBA:
-        LOG_EVERY_N(INFO, 100) << "received a " << src_width << "x" << src_height << " RGBA frame";
-        if (!ConvertToYUV(sample_.image(), libyuv::FOURCC_RGBA, 4, unscaled_)) {
-            return;
-        }
-        break;
-    case hal::PB_RGB:
-        LOG_EVERY_N(INFO, 100) << "received a " << src_width << "x" << src_height << " RGB frame";
-        if (!ConvertToYUV(sample_.image(), libyuv::FOURCC_RAW, 3, unscaled_)) {
-            return;
-        }
-        break;
-    default:
-        LOG(ERROR) << "expected camera sample with RGBA or luminance format, but got " << sample_.image().format();
-        return;
-    }
-
-    // scale the frame if necessary
-    auto frame = unscaled_;
-    if (src_width != output_width || src_height != output_height) {
-        // Use libyuv directly since WebRTC wrappers don't support RGBA
-        LOG_EVERY_N(INFO, 100) << "scaling YUV image " << src_width << "x" << src_height << " -> " << output_width << "x" << output_height;
-        if (libyuv::I420Scale( // params for scaling
-                unscaled_->MutableDataY(), // input Y plane
-                unscaled_->StrideY(), // input Y stride
-                unscaled_->MutableDataU(), // input U plane
-                unscaled_->StrideU(), // input U stride
-                unscaled_->MutableDataV(), // input V plane
-                unscaled_->StrideV(), // input V stride
-                unscaled_->width(), // input width
-                unscaled_->height(), // input height
-                scaled_->MutableDataY(), // output Y plane
-                scaled_->StrideY(), // output Y stride
-                scaled_->MutableDataU(), // output U plane
-                scaled_->StrideU(), // output U stride
-                scaled_->MutableDataV(), // output V plane
-                scaled_->StrideV(), // output V stride
-                scaled_->width(), // output width
-                scaled_->height(), // output height
-                libyuv::kFilterBox)
-            != 0) {
-
-            LOG(ERROR) << "failed to scale I420 frame";
-            return;
-        }
-
-        frame = scaled_;
-    }
-
-    LOG_EVERY_N(INFO, 100) << "converted image to I420, dispatching a " << frame->width() << "x" << frame->height() << " frame";
-    OnFrame(webrtc::VideoFrame(frame, 0, rtc::TimeMillis(), webrtc::kVideoRotation_0), frame->width(), frame->height());
+    OnFrame(video_frame, frame->width(), frame->height());
 }
 
 bool VideoCapturer::IsRunning() { return capture_state() == cricket::CS_RUNNING; }
@@ -225,8 +116,11 @@ bool VideoCapturer::GetPreferredFourccs(std::vector<uint32_t>* fourccs) {
         return false;
     }
 
-    // This class does not yet support multiple pixel formats.
-    // fourccs->push_back(format_.fourcc);
+    // YUV layouts that cameras can publish for us to pass on without
+    // converting through RGB, cheapest first
+    fourccs->push_back(cricket::FOURCC_I420);
+    fourccs->push_back(cricket::FOURCC_NV12);
+    fourccs->push_back(cricket::FOURCC_YUY2);
     return true;
 }
 
@@ -239,6 +133,12 @@ bool VideoCapturer::GetBestCaptureFormat(const cricket::VideoFormat& desired, cr
     return true;
 }
 
-bool VideoCapturer::IsScreencast() const { return false; }
+bool VideoCapturer::IsScreencast() const {
+    // webrtc keeps the resolution of screencasts and drops their frame rate
+    // instead, so this is how the session's degradation preference gets to
+    // the encoder
+    auto session = session_.lock();
+    return session && session->maintain_resolution();
+}
 
 } // namespace scy
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "glog/logging.h"
+
+#include "packages/streamer/include/worker_pool.h"
+
+namespace streamer {
+
+WorkerPool::WorkerPool(size_t num_threads)
+    : m_should_continue(true) {
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    LOG(INFO) << "starting " << num_threads << " worker threads";
+    for (size_t i = 0; i < num_threads; i++) {
+        m_threads.emplace_back(&WorkerPool::Loop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_guard);
+        m_should_continue = false;
+    }
+    m_wakeup.notify_all();
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::Post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_guard);
+        m_tasks.push_back(std::move(task));
+    }
+    m_wakeup.notify_one();
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+    struct State {
+        std::atomic<size_t> next;
+        size_t done;
+        std::mutex guard;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+
+    // Helpers that only get scheduled after every index has been claimed
+    // return without touching FN, which may be gone by then
+    auto work = [state, count, &fn] {
+        size_t i;
+        while ((i = state->next++) < count) {
+            fn(i);
+            std::lock_guard<std::mutex> lock(state->guard);
+            if (++state->done == count) {
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    const size_t helpers = std::min(count > 0 ? count - 1 : 0, m_threads.size());
+    for (size_t i = 0; i < helpers; i++) {
+        Post(work);
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(state->guard);
+    state->finished.wait(lock, [&] { return state->done == count; });
+}
+
+void WorkerPool::Loop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_guard);
+            m_wakeup.wait(lock, [this] { return !m_tasks.empty() || !m_should_continue; });
+            if (m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace streamer
@@ -0,0 +1,70 @@
+#include "gtest/gtest.h"
+
+#include "packages/streamer/include/frame_pool.h"
+
+namespace streamer {
+
+TEST(FramePoolTest, ReusesFreeBufferOfSameSize) {
+    FramePool pool("test", 4);
+    const webrtc::I420Buffer* first = pool.CreateBuffer(320, 240).get();
+    auto second = pool.CreateBuffer(320, 240);
+
+    EXPECT_EQ(first, second.get());
+    EXPECT_EQ(1u, pool.stats().hits);
+    EXPECT_EQ(1u, pool.stats().misses);
+    EXPECT_EQ(1u, pool.stats().size);
+}
+
+TEST(FramePoolTest, AllocatesWhileBuffersAreInUse) {
+    FramePool pool("test", 4);
+    auto first = pool.CreateBuffer(320, 240);
+    auto second = pool.CreateBuffer(320, 240);
+
+    EXPECT_NE(first.get(), second.get());
+    EXPECT_EQ(0u, pool.stats().hits);
+    EXPECT_EQ(2u, pool.stats().misses);
+    EXPECT_EQ(2u, pool.stats().size);
+    EXPECT_EQ(2u, pool.stats().high_water);
+}
+
+TEST(FramePoolTest, EvictsLeastRecentlyUsedFreeBuffer) {
+    FramePool pool("test", 2);
+    pool.CreateBuffer(320, 240);
+    pool.CreateBuffer(640, 480);
+    pool.CreateBuffer(320, 240);
+
+    // The 640x480 buffer was used least recently, so it makes way
+    pool.CreateBuffer(160, 120);
+    EXPECT_EQ(1u, pool.stats().evictions);
+    EXPECT_EQ(2u, pool.stats().size);
+
+    pool.CreateBuffer(320, 240);
+    EXPECT_EQ(2u, pool.stats().hits);
+    pool.CreateBuffer(640, 480);
+    EXPECT_EQ(2u, pool.stats().hits);
+    EXPECT_EQ(2u, pool.stats().evictions);
+}
+
+TEST(FramePoolTest, DoesNotGrowBeyondCapacity) {
+    FramePool pool("test", 2);
+    auto first = pool.CreateBuffer(320, 240);
+    auto second = pool.CreateBuffer(320, 240);
+    auto third = pool.CreateBuffer(320, 240);
+
+    ASSERT_TRUE(third);
+    EXPECT_EQ(320, third->width());
+    EXPECT_EQ(1u, pool.stats().unpooled);
+    EXPECT_EQ(2u, pool.stats().size);
+
+    // The unpooled buffer is gone once released, and the pooled ones return
+    const webrtc::I420Buffer* unpooled = third.get();
+    third = nullptr;
+    first = nullptr;
+    second = nullptr;
+    auto again = pool.CreateBuffer(320, 240);
+    EXPECT_NE(unpooled, again.get());
+    EXPECT_EQ(1u, pool.stats().hits);
+    EXPECT_EQ(2u, pool.stats().size);
+}
+
+} // namespace streamer
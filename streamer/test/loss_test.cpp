@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "zmq.hpp"
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/api/test/fakeconstraints.h"
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/base/fakenetwork.h"
+#include "webrtc/base/physicalsocketserver.h"
+#include "webrtc/base/ssladapter.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/base/virtualsocketserver.h"
+#include "webrtc/media/base/mediaconstants.h"
+#include "webrtc/media/base/videosinkinterface.h"
+#include "webrtc/p2p/base/basicpacketsocketfactory.h"
+#include "webrtc/p2p/client/basicportallocator.h"
+#include "webrtc/system_wrappers/include/field_trial_default.h"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/convert.h"
+#include "packages/streamer/include/encoder_factory.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/latency.h"
+#include "packages/streamer/include/loss_resilience.h"
+#include "packages/streamer/include/raw_sample.h"
+#include "packages/streamer/include/session.h"
+#include "packages/streamer/include/video_capturer.h"
+#include "packages/streamer/proto/signaler_options.pb.h"
+#include "packages/streamer/proto/stream.pb.h"
+
+namespace streamer {
+
+namespace {
+    const char kAddress[] = "inproc://loss-test";
+    const char kTopic[] = "camera";
+    const int kWidth = 320;
+    const int kHeight = 240;
+    const int kFps = 30;
+
+    // Each frame carries its index as this many black or white stripes, most
+    // significant bit first, which survive scaling and lossy encoding
+    const int kIndexBits = 16;
+    const int kMaxFrames = 1 << kIndexBits;
+
+    // The simulated link: a cellular round trip, and the share of packets
+    // lost in either direction once the video is flowing
+    const int kOneWayDelayMs = 40;
+    const int kJitterMs = 5;
+    const double kLossRate = 0.05;
+
+    // Time allowed for the connection to come up and the first frame to
+    // arrive, and the time over which each setting is measured under loss
+    const int kConnectTimeoutMs = 15000;
+    const int kLossyRunMs = 8000;
+
+    // Gap between rendered frames that counts as a freeze, which is how
+    // webrtc defines one: three frame intervals, or one plus 150 ms
+    const int64_t kFrameIntervalUs = 1000000 / kFps;
+    const int64_t kFreezeThresholdUs = std::max<int64_t>(3 * kFrameIntervalUs, kFrameIntervalUs + 150000);
+
+    // Latencies beyond this come from stripes that were misread
+    const int64_t kMaxLatencyUs = 5000000;
+
+    // Publisher sends RGBA camera samples that show their index as stripes,
+    // remembering when each was sent, until it is destroyed
+    class Publisher {
+    public:
+        explicit Publisher(zmq::context_t* ctx)
+            : m_socket(*ctx, ZMQ_PUB)
+            , m_sent_us(new std::atomic<int64_t>[kMaxFrames])
+            , m_running(true) {
+            for (int i = 0; i < kMaxFrames; i++) {
+                m_sent_us[i] = -1;
+            }
+            m_socket.bind(kAddress);
+            m_thread = std::thread([this] { Run(); });
+        }
+
+        ~Publisher() {
+            m_running = false;
+            m_thread.join();
+            m_socket.unbind(kAddress);
+        }
+
+        // Get the time at which a frame was sent on the rtc::TimeMicros
+        // clock, or -1 if it was not
+        int64_t sent_us(int index) const { return index >= 0 && index < kMaxFrames ? m_sent_us[index].load() : -1; }
+
+    private:
+        void Run() {
+            hal::CameraSample sample;
+            sample.mutable_image()->set_cols(kWidth);
+            sample.mutable_image()->set_rows(kHeight);
+            sample.mutable_image()->set_format(hal::PB_RGBA);
+            sample.mutable_image()->set_type(hal::PB_UNSIGNED_BYTE);
+            std::vector<uint8_t> pixels(ImageSize(PixelFormat::RGBA, kWidth, kHeight));
+            for (int index = 0; m_running && index < kMaxFrames; index++) {
+                Draw(index, &pixels);
+                sample.set_id(index);
+                m_sent_us[index] = rtc::TimeMicros();
+                SendSample(m_socket, kTopic, sample, pixels.data(), pixels.size());
+                std::this_thread::sleep_for(std::chrono::microseconds(kFrameIntervalUs));
+            }
+        }
+
+        // Draw the stripes for a frame index
+        static void Draw(int index, std::vector<uint8_t>* pixels) {
+            for (int y = 0; y < kHeight; y++) {
+                for (int x = 0; x < kWidth; x++) {
+                    const int bit = kIndexBits - 1 - x * kIndexBits / kWidth;
+                    const uint8_t value = (index >> bit) & 1 ? 255 : 0;
+                    uint8_t* pixel = &(*pixels)[4 * (y * kWidth + x)];
+                    pixel[0] = pixel[1] = pixel[2] = value;
+                    pixel[3] = 255;
+                }
+            }
+        }
+
+        zmq::socket_t m_socket;
+        std::unique_ptr<std::atomic<int64_t>[]> m_sent_us;
+        std::atomic<bool> m_running;
+        std::thread m_thread;
+    };
+
+    // Read the index of a frame from its stripes
+    int ReadIndex(const webrtc::VideoFrame& frame) {
+        rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = frame.video_frame_buffer();
+        if (buffer->native_handle()) {
+            buffer = buffer->NativeToI420Buffer();
+        }
+        const int width = buffer->width();
+        const int height = buffer->height();
+        int index = 0;
+        for (int bit = 0; bit < kIndexBits; bit++) {
+            // Average the luma down the middle of the stripe
+            const int x = (2 * bit + 1) * width / (2 * kIndexBits);
+            int sum = 0;
+            int count = 0;
+            for (int y = height / 4; y < 3 * height / 4; y += 2) {
+                sum += buffer->DataY()[y * buffer->StrideY() + x];
+                count++;
+            }
+            index = (index << 1) | (sum > 128 * count ? 1 : 0);
+        }
+        return index;
+    }
+
+    // Sink receives the decoded frames and measures how long each took from
+    // the publisher, and how often the video froze
+    class Sink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+    public:
+        explicit Sink(const Publisher* publisher)
+            : m_publisher(publisher)
+            , m_measuring(false)
+            , m_frames(0)
+            , m_measured_frames(0)
+            , m_freezes(0)
+            , m_freeze_us(0)
+            , m_last_us(0) {}
+
+        void OnFrame(const webrtc::VideoFrame& frame) override {
+            const int64_t now_us = rtc::TimeMicros();
+            const int64_t sent_us = m_publisher->sent_us(ReadIndex(frame));
+            std::lock_guard<std::mutex> lock(m_guard);
+            m_frames++;
+            if (!m_measuring) {
+                return;
+            }
+            m_measured_frames++;
+            if (sent_us >= 0 && now_us - sent_us >= 0 && now_us - sent_us < kMaxLatencyUs) {
+                m_latency.Record(now_us - sent_us);
+            }
+            RecordGap(now_us);
+        }
+
+        // Start measuring from now
+        void StartMeasuring() {
+            std::lock_guard<std::mutex> lock(m_guard);
+            m_measuring = true;
+            m_last_us = rtc::TimeMicros();
+        }
+
+        // Stop measuring, counting the time since the last frame
+        void StopMeasuring() {
+            std::lock_guard<std::mutex> lock(m_guard);
+            RecordGap(rtc::TimeMicros());
+            m_measuring = false;
+        }
+
+        int frames() {
+            std::lock_guard<std::mutex> lock(m_guard);
+            return m_frames;
+        }
+
+        int measured_frames() {
+            std::lock_guard<std::mutex> lock(m_guard);
+            return m_measured_frames;
+        }
+
+        int freezes() {
+            std::lock_guard<std::mutex> lock(m_guard);
+            return m_freezes;
+        }
+
+        int64_t freeze_us() {
+            std::lock_guard<std::mutex> lock(m_guard);
+            return m_freeze_us;
+        }
+
+        const LatencyHistogram& latency() const { return m_latency; }
+
+    private:
+        // Count the time since the last frame as a freeze if it was long
+        void RecordGap(int64_t now_us) {
+            if (now_us - m_last_us > kFreezeThresholdUs) {
+                m_freezes++;
+                m_freeze_us += now_us - m_last_us;
+            }
+            m_last_us = now_us;
+        }
+
+        const Publisher* m_publisher;
+        LatencyHistogram m_latency;
+        bool m_measuring;
+        int m_frames;
+        int m_measured_frames;
+        int m_freezes;
+        int64_t m_freeze_us;
+        int64_t m_last_us;
+        std::mutex m_guard;
+    };
+
+    class IgnoreSetObserver : public webrtc::SetSessionDescriptionObserver {
+    public:
+        static IgnoreSetObserver* Create() { return new rtc::RefCountedObject<IgnoreSetObserver>(); }
+
+        void OnSuccess() override {}
+        void OnFailure(const std::string& error) override { ADD_FAILURE() << "failed to set description: " << error; }
+    };
+
+    // Receiver stands in for the viewer's browser: it answers the offer and
+    // renders the video into the sink
+    class Receiver : public webrtc::PeerConnectionObserver, public webrtc::CreateSessionDescriptionObserver {
+    public:
+        typedef std::function<void(const std::string& sdp)> AnswerHandler;
+        typedef std::function<void(const webrtc::IceCandidateInterface* candidate)> IceCandidateHandler;
+
+        explicit Receiver(Sink* sink)
+            : m_sink(sink) {
+            m_constraints.SetMandatoryReceiveAudio(false);
+            m_constraints.SetMandatoryReceiveVideo(true);
+        }
+
+        void Connect(webrtc::PeerConnectionFactoryInterface* factory,
+            const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+            std::unique_ptr<cricket::PortAllocator> allocator,
+            AnswerHandler on_answer,
+            IceCandidateHandler on_candidate) {
+            m_on_answer = on_answer;
+            m_on_candidate = on_candidate;
+            m_connection = factory->CreatePeerConnection(config, &m_constraints, std::move(allocator), nullptr, this);
+            ASSERT_TRUE(m_connection);
+        }
+
+        void SetOffer(const std::string& sdp) {
+            webrtc::SdpParseError error;
+            webrtc::SessionDescriptionInterface* desc(webrtc::CreateSessionDescription("offer", sdp, &error));
+            ASSERT_TRUE(desc) << "failed to parse offer: " << error.description;
+            m_connection->SetRemoteDescription(IgnoreSetObserver::Create(), desc);
+            m_connection->CreateAnswer(this, &m_constraints);
+        }
+
+        void AddIceCandidate(const webrtc::IceCandidateInterface* candidate) {
+            EXPECT_TRUE(m_connection->AddIceCandidate(candidate)) << "failed to add candidate";
+        }
+
+        void Close() {
+            if (m_track) {
+                m_track->RemoveSink(m_sink);
+                m_track = nullptr;
+            }
+            if (m_connection) {
+                m_connection->Close();
+                m_connection = nullptr;
+            }
+        }
+
+        // webrtc::PeerConnectionObserver implementation
+        void OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState new_state) override {}
+        void OnAddStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override {
+            auto tracks = stream->GetVideoTracks();
+            if (!tracks.empty()) {
+                m_track = tracks[0];
+                m_track->AddOrUpdateSink(m_sink, rtc::VideoSinkWants());
+            }
+        }
+        void OnRemoveStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override {}
+        void OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel) override {}
+        void OnRenegotiationNeeded() override {}
+        void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState new_state) override {}
+        void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState new_state) override {}
+        void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override { m_on_candidate(candidate); }
+
+        // webrtc::CreateSessionDescriptionObserver implementation
+        void OnSuccess(webrtc::SessionDescriptionInterface* desc) override {
+            std::string sdp;
+            desc->ToString(&sdp);
+            m_connection->SetLocalDescription(IgnoreSetObserver::Create(), desc);
+            m_on_answer(sdp);
+        }
+        void OnFailure(const std::string& error) override { ADD_FAILURE() << "failed to create answer: " << error; }
+
+        int AddRef() const override { return 1; }
+        int Release() const override { return 0; }
+
+    private:
+        Sink* m_sink;
+        webrtc::FakeConstraints m_constraints;
+        rtc::scoped_refptr<webrtc::PeerConnectionInterface> m_connection;
+        rtc::scoped_refptr<webrtc::VideoTrackInterface> m_track;
+        AnswerHandler m_on_answer;
+        IceCandidateHandler m_on_candidate;
+    };
+
+    // A loss resilience setting to measure
+    struct Setting {
+        std::string name;
+        LossResilienceOptions opts;
+    };
+
+    std::vector<Setting> Settings() {
+        std::vector<Setting> settings;
+        LossResilienceOptions opts;
+        settings.push_back({ "webrtc defaults (NACK, RTX, ULPFEC)", opts });
+
+        opts.set_fec(LossResilienceOptions::NO_FEC);
+        settings.push_back({ "NACK and RTX, no FEC", opts });
+
+        opts.set_disable_rtx(true);
+        settings.push_back({ "NACK without RTX, no FEC", opts });
+
+        opts.set_disable_nack(true);
+        opts.set_fec(LossResilienceOptions::ULPFEC);
+        settings.push_back({ "ULPFEC only", opts });
+
+        opts.set_fec(LossResilienceOptions::FLEXFEC);
+        settings.push_back({ "FlexFEC only", opts });
+
+        opts.set_fec(LossResilienceOptions::NO_FEC);
+        settings.push_back({ "no NACK, RTX or FEC", opts });
+
+        LossResilienceOptions low_latency;
+        low_latency.set_preset(LossResilienceOptions::LOW_LATENCY);
+        settings.push_back({ "low latency preset", low_latency });
+        return settings;
+    }
+
+    // Process signaling messages on this thread until DONE returns true or
+    // the timeout passes. Returns the last result of DONE.
+    bool ProcessUntil(std::function<bool()> done, int timeout_ms) {
+        const int64_t deadline_ms = rtc::TimeMillis() + timeout_ms;
+        while (!done() && rtc::TimeMillis() < deadline_ms) {
+            rtc::Thread::Current()->ProcessMessages(10);
+        }
+        return done();
+    }
+} // namespace
+
+// A session streams to a viewer over a simulated lossy link, once for each
+// loss resilience setting, and the latency and freezes the viewer sees are
+// reported for comparison. The signaling thread is the test thread.
+TEST(LossTest, LatencyAndFreezesUnderLoss) {
+    rtc::InitializeSSL();
+    webrtc::field_trial::InitFieldTrialsFromString(kFlexFecFieldTrials);
+
+    // Every packet goes through the virtual network on the network thread
+    rtc::PhysicalSocketServer physical;
+    rtc::VirtualSocketServer network(&physical);
+    network.set_delay_mean(kOneWayDelayMs);
+    network.set_delay_stddev(kJitterMs);
+    network.UpdateDelayDistribution();
+    rtc::Thread network_thread(&network);
+    ASSERT_TRUE(network_thread.Start());
+    std::unique_ptr<rtc::Thread> worker_thread = rtc::Thread::Create();
+    ASSERT_TRUE(worker_thread->Start());
+
+    rtc::FakeNetworkManager networks;
+    networks.AddInterface(rtc::SocketAddress("192.168.1.1", 0));
+    rtc::BasicPacketSocketFactory socket_factory(&network_thread);
+    auto allocator = [&networks, &socket_factory]() {
+        return std::unique_ptr<cricket::PortAllocator>(new cricket::BasicPortAllocator(&networks, &socket_factory));
+    };
+    webrtc::PeerConnectionInterface::RTCConfiguration config;
+    config.tcp_candidate_policy = webrtc::PeerConnectionInterface::kTcpCandidatePolicyDisabled;
+
+    zmq::context_t ctx(1);
+    FrameSourceRegistry sources(&ctx, 2);
+    Stream source;
+    source.set_address(kAddress);
+    source.set_topic(kTopic);
+    source.set_output_width(kWidth);
+    source.set_output_height(kHeight);
+
+    std::ostringstream report;
+    for (const Setting& setting : Settings()) {
+        SCOPED_TRACE(setting.name);
+        const LossResilienceOptions resilience = ApplyLossResiliencePreset(setting.opts);
+        auto factory = webrtc::CreatePeerConnectionFactory(&network_thread,
+            worker_thread.get(),
+            rtc::Thread::Current(),
+            nullptr,
+            new EncoderFactory(EncoderOptions(), resilience),
+            nullptr);
+        ASSERT_TRUE(factory);
+
+        Publisher publisher(&ctx);
+        Sink sink(&publisher);
+        Receiver receiver(&sink);
+
+        // Offer what the signaler would offer for this setting
+        auto session = std::make_shared<Session>(setting.name, &sources);
+        VideoSdpOptions sdp_options = VideoSdpOptionsFor(resilience);
+        sdp_options.codecs = { cricket::kVp8CodecName };
+        session->SetVideoSdpOptions(sdp_options);
+        session->Connect(source);
+        session->constraints()->SetMandatoryReceiveAudio(false);
+        session->constraints()->SetMandatoryReceiveVideo(false);
+
+        std::weak_ptr<Session> weak_session(session);
+        receiver.Connect(factory,
+            config,
+            allocator(),
+            [weak_session](const std::string& sdp) {
+                if (auto session = weak_session.lock()) {
+                    session->SetRemoteDescription("answer", sdp);
+                }
+            },
+            [weak_session](const webrtc::IceCandidateInterface* candidate) {
+                std::string sdp;
+                ASSERT_TRUE(candidate->ToString(&sdp));
+                if (auto session = weak_session.lock()) {
+                    session->AddIceCandidate(candidate->sdp_mid(), candidate->sdp_mline_index(), sdp);
+                }
+            });
+        session->OnSDPCreated([&receiver](webrtc::SessionDescriptionInterface* desc) {
+            std::string sdp;
+            ASSERT_TRUE(desc->ToString(&sdp));
+            receiver.SetOffer(sdp);
+        });
+        session->OnIceCandidate([&receiver](const webrtc::IceCandidateInterface* candidate) { receiver.AddIceCandidate(candidate); });
+
+        auto track = factory->CreateVideoTrack("video", factory->CreateVideoSource(new VideoCapturer(session), nullptr));
+        session->SetVideoTrack(track);
+        auto stream = factory->CreateLocalMediaStream("stream");
+        stream->AddTrack(track);
+        auto connection = factory->CreatePeerConnection(config, session->constraints(), allocator(), nullptr, session->observer());
+        ASSERT_TRUE(connection);
+        ASSERT_TRUE(connection->AddStream(stream));
+        session->SetConnection(connection);
+        session->CreateOffer();
+
+        // Connect over a clean link, then start losing packets
+        ASSERT_TRUE(ProcessUntil([&sink] { return sink.frames() > 0; }, kConnectTimeoutMs)) << "no video before the loss started";
+        network_thread.Invoke<void>(RTC_FROM_HERE, [&network] { network.set_drop_probability(kLossRate); });
+        sink.StartMeasuring();
+        ProcessUntil([] { return false; }, kLossyRunMs);
+        sink.StopMeasuring();
+        network_thread.Invoke<void>(RTC_FROM_HERE, [&network] { network.set_drop_probability(0); });
+
+        report << setting.name << ": " << sink.measured_frames() << " frames, glass-to-glass " << sink.latency() << ", "
+               << sink.freezes() << " freezes totalling " << sink.freeze_us() / 1000 << " ms\n";
+        EXPECT_GT(sink.measured_frames(), kLossyRunMs * kFps / 1000 / 10) << "video barely survived the loss";
+        EXPECT_GT(sink.latency().count(), 0u) << "no frame could be timed";
+
+        receiver.Close();
+        session.reset();
+        stream = nullptr;
+        track = nullptr;
+        connection = nullptr;
+        factory = nullptr;
+    }
+
+    std::cout << "glass-to-glass latency and freezes at " << kLossRate * 100 << "% loss and " << 2 * kOneWayDelayMs
+              << " ms round trip:\n"
+              << report.str();
+
+    network_thread.Stop();
+    worker_thread->Stop();
+    rtc::CleanupSSL();
+}
+
+} // namespace streamer
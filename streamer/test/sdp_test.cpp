@@ -0,0 +1,114 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "packages/streamer/include/sdp.h"
+
+namespace streamer {
+
+namespace {
+    // A video offer as Chrome makes it, trimmed to the lines that matter
+    const char kOffer[] = "v=0\r\n"
+                          "o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+                          "s=-\r\n"
+                          "t=0 0\r\n"
+                          "m=video 9 UDP/TLS/RTP/SAVPF 96 97 100 101 102 127\r\n"
+                          "c=IN IP4 0.0.0.0\r\n"
+                          "a=rtpmap:96 VP8/90000\r\n"
+                          "a=rtcp-fb:96 goog-remb\r\n"
+                          "a=rtcp-fb:96 nack\r\n"
+                          "a=rtcp-fb:96 nack pli\r\n"
+                          "a=rtpmap:97 rtx/90000\r\n"
+                          "a=fmtp:97 apt=96\r\n"
+                          "a=rtpmap:100 red/90000\r\n"
+                          "a=rtpmap:101 ulpfec/90000\r\n"
+                          "a=rtpmap:102 flexfec-03/90000\r\n"
+                          "a=rtcp-fb:102 transport-cc\r\n"
+                          "a=fmtp:102 repair-window=10000000\r\n"
+                          "a=rtpmap:127 H264/90000\r\n"
+                          "a=fmtp:127 packetization-mode=1\r\n"
+                          "a=ssrc-group:FID 1111 2222\r\n"
+                          "a=ssrc-group:FEC-FR 1111 3333\r\n"
+                          "a=ssrc:1111 cname:camera\r\n"
+                          "a=ssrc:1111 msid:stream video\r\n"
+                          "a=ssrc:2222 cname:camera\r\n"
+                          "a=ssrc:2222 msid:stream video\r\n"
+                          "a=ssrc:3333 cname:camera\r\n"
+                          "a=ssrc:3333 msid:stream video\r\n";
+
+    // Returns true if the SDP has the line
+    bool HasLine(const std::string& sdp, const std::string& line) { return sdp.find(line + "\r\n") != std::string::npos; }
+} // namespace
+
+TEST(SdpTest, KeepsFlexfecWhenConfigured) {
+    std::string sdp = kOffer;
+    VideoSdpOptions opts;
+    opts.codecs = { "VP8" };
+    opts.fec = { "flexfec-03" };
+    ASSERT_TRUE(RewriteVideoSdp(&sdp, opts));
+
+    EXPECT_TRUE(HasLine(sdp, "m=video 9 UDP/TLS/RTP/SAVPF 96 97 102"));
+    EXPECT_TRUE(HasLine(sdp, "a=rtpmap:102 flexfec-03/90000"));
+    EXPECT_TRUE(HasLine(sdp, "a=fmtp:102 repair-window=10000000"));
+    EXPECT_TRUE(HasLine(sdp, "a=rtpmap:97 rtx/90000"));
+    EXPECT_FALSE(HasLine(sdp, "a=rtpmap:100 red/90000"));
+    EXPECT_FALSE(HasLine(sdp, "a=rtpmap:101 ulpfec/90000"));
+    EXPECT_FALSE(HasLine(sdp, "a=rtpmap:127 H264/90000"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc-group:FID 1111 2222"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc-group:FEC-FR 1111 3333"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc:2222 cname:camera"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc:3333 cname:camera"));
+}
+
+TEST(SdpTest, DropsAllProtectionWithoutFec) {
+    std::string sdp = kOffer;
+    VideoSdpOptions opts;
+    opts.codecs = { "VP8" };
+    opts.fec.clear();
+    ASSERT_TRUE(RewriteVideoSdp(&sdp, opts));
+
+    EXPECT_TRUE(HasLine(sdp, "m=video 9 UDP/TLS/RTP/SAVPF 96 97"));
+    EXPECT_EQ(std::string::npos, sdp.find("red/90000"));
+    EXPECT_EQ(std::string::npos, sdp.find("ulpfec/90000"));
+    EXPECT_EQ(std::string::npos, sdp.find("flexfec-03/90000"));
+    EXPECT_EQ(std::string::npos, sdp.find("a=ssrc-group:FEC-FR"));
+    EXPECT_EQ(std::string::npos, sdp.find("a=ssrc:3333"));
+}
+
+TEST(SdpTest, DropsRtxSsrcsWithoutRtx) {
+    std::string sdp = kOffer;
+    VideoSdpOptions opts;
+    opts.codecs = { "VP8" };
+    opts.rtx = false;
+    ASSERT_TRUE(RewriteVideoSdp(&sdp, opts));
+
+    EXPECT_FALSE(HasLine(sdp, "a=rtpmap:97 rtx/90000"));
+    EXPECT_EQ(std::string::npos, sdp.find("a=ssrc-group:FID"));
+    EXPECT_EQ(std::string::npos, sdp.find("a=ssrc:2222"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc:1111 cname:camera"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc:1111 msid:stream video"));
+    EXPECT_TRUE(HasLine(sdp, "a=ssrc-group:FEC-FR 1111 3333"));
+}
+
+TEST(SdpTest, DropsNackButKeepsPli) {
+    std::string sdp = kOffer;
+    VideoSdpOptions opts;
+    opts.nack = false;
+    opts.rtx = false;
+    ASSERT_TRUE(RewriteVideoSdp(&sdp, opts));
+
+    EXPECT_TRUE(HasLine(sdp, "m=video 9 UDP/TLS/RTP/SAVPF 96 127 100 101 102"));
+    EXPECT_FALSE(HasLine(sdp, "a=rtcp-fb:96 nack"));
+    EXPECT_TRUE(HasLine(sdp, "a=rtcp-fb:96 nack pli"));
+    EXPECT_FALSE(HasLine(sdp, "a=rtpmap:97 rtx/90000"));
+}
+
+TEST(SdpTest, LeavesSdpAloneWithoutPreferredCodec) {
+    std::string sdp = kOffer;
+    VideoSdpOptions opts;
+    opts.codecs = { "VP9" };
+    EXPECT_FALSE(RewriteVideoSdp(&sdp, opts));
+    EXPECT_EQ(kOffer, sdp);
+}
+
+} // namespace streamer
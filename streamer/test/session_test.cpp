@@ -0,0 +1,170 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "zmq.hpp"
+
+#include "webrtc/api/video/video_frame.h"
+#include "webrtc/media/base/videocommon.h"
+#include "webrtc/media/base/videosinkinterface.h"
+
+#include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/convert.h"
+#include "packages/streamer/include/frame_source.h"
+#include "packages/streamer/include/raw_sample.h"
+#include "packages/streamer/include/session.h"
+#include "packages/streamer/include/video_capturer.h"
+#include "packages/streamer/proto/stream.pb.h"
+
+namespace streamer {
+
+namespace {
+    const char kAddress[] = "inproc://session-test";
+    const char kTopic[] = "camera";
+    const int kWidth = 320;
+    const int kHeight = 240;
+
+    // Number of sessions created and torn down while frames are flowing, and
+    // how many of them warm up the allocator and the worker threads before
+    // the process is measured
+    const int kCycles = 3000;
+    const int kWarmupCycles = 100;
+
+    // How far the process may grow over the measured cycles. A session that
+    // leaked its frame buffers or a thread would blow through both.
+    const long kMaxRssGrowthKb = 16 * 1024;
+    const long kMaxThreadGrowth = 2;
+
+    // CountingSink stands in for the encoder, so that the capturer wants frames
+    class CountingSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+    public:
+        void OnFrame(const webrtc::VideoFrame& frame) override { count++; }
+
+        std::atomic<int> count{ 0 };
+    };
+
+    // Publisher sends RGBA camera samples until it is destroyed
+    class Publisher {
+    public:
+        explicit Publisher(zmq::context_t* ctx)
+            : m_socket(*ctx, ZMQ_PUB)
+            , m_running(true) {
+            m_socket.bind(kAddress);
+            m_thread = std::thread([this] { Run(); });
+        }
+
+        ~Publisher() {
+            m_running = false;
+            m_thread.join();
+        }
+
+    private:
+        void Run() {
+            hal::CameraSample sample;
+            sample.mutable_image()->set_cols(kWidth);
+            sample.mutable_image()->set_rows(kHeight);
+            sample.mutable_image()->set_format(hal::PB_RGBA);
+            sample.mutable_image()->set_type(hal::PB_UNSIGNED_BYTE);
+            std::vector<uint8_t> pixels(ImageSize(PixelFormat::RGBA, kWidth, kHeight), 128);
+            uint64_t id = 0;
+            while (m_running) {
+                sample.set_id(id++);
+                SendSample(m_socket, kTopic, sample, pixels.data(), pixels.size());
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+
+        zmq::socket_t m_socket;
+        std::atomic<bool> m_running;
+        std::thread m_thread;
+    };
+
+    Stream TestStream() {
+        Stream stream;
+        stream.set_address(kAddress);
+        stream.set_topic(kTopic);
+        stream.set_output_width(kWidth / 2);
+        stream.set_output_height(kHeight / 2);
+        stream.set_degradation_preference(Stream::MAINTAIN_RESOLUTION);
+        return stream;
+    }
+
+    // Wait until the sink has received a frame, or give up after a second
+    bool WaitForFrame(const CountingSink& sink) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (sink.count == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return sink.count > 0;
+    }
+
+    // Read a numeric field such as VmRSS or Threads from /proc/self/status,
+    // or -1 if there is no such field
+    long ProcessStatus(const std::string& field) {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, field.size() + 1, field + ":") == 0) {
+                return std::stol(line.substr(field.size() + 1));
+            }
+        }
+        return -1;
+    }
+} // namespace
+
+// Sessions are reaped while frames are flowing, and the capturer, which
+// webrtc owns, outlives them. Nothing may reach the session after that, and
+// every frame source must be released. Thousands of cycles must not grow
+// the process's memory or thread count.
+TEST(SessionTest, ReapWhileFramesFlow) {
+    zmq::context_t ctx(1);
+    Publisher publisher(&ctx);
+    FrameSourceRegistry sources(&ctx, 2);
+
+    long warm_rss_kb = -1;
+    long warm_threads = -1;
+    for (int i = 0; i < kCycles; i++) {
+        if (i == kWarmupCycles) {
+            warm_rss_kb = ProcessStatus("VmRSS");
+            warm_threads = ProcessStatus("Threads");
+            ASSERT_GT(warm_rss_kb, 0);
+            ASSERT_GT(warm_threads, 0);
+        }
+
+        auto session = std::make_shared<Session>("session", &sources);
+        std::unique_ptr<VideoCapturer> capturer(new VideoCapturer(session));
+        CountingSink sink;
+        capturer->AddOrUpdateSink(&sink, rtc::VideoSinkWants());
+        ASSERT_TRUE(capturer->StartCapturing(cricket::VideoFormat(kWidth / 2, kHeight / 2, 0, cricket::FOURCC_I420)));
+
+        session->Connect(TestStream());
+        session->observer()->OnIceConnectionChange(webrtc::PeerConnectionInterface::kIceConnectionConnected);
+        ASSERT_TRUE(WaitForFrame(sink)) << "no frame in cycle " << i;
+        EXPECT_TRUE(capturer->IsScreencast());
+
+        // Reap the session with the capturer still running
+        session.reset();
+        const int delivered = sink.count;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT_EQ(delivered, sink.count) << "frame delivered after the session was reaped";
+        EXPECT_FALSE(capturer->IsScreencast());
+
+        capturer->Stop();
+        capturer->RemoveSink(&sink);
+    }
+
+    EXPECT_LE(ProcessStatus("VmRSS"), warm_rss_kb + kMaxRssGrowthKb) << "memory grew from " << warm_rss_kb << " kB";
+    EXPECT_LE(ProcessStatus("Threads"), warm_threads + kMaxThreadGrowth) << "threads grew from " << warm_threads;
+
+    std::ostringstream stats;
+    sources.PrintStats(stats);
+    EXPECT_EQ("", stats.str()) << "frame sources outlived their sessions";
+}
+
+} // namespace streamer
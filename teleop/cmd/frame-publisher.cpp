@@ -14,12 +14,14 @@
 #include "packages/net/include/zmq_topic_pub.h"
 
 #include "packages/hal/proto/camera_sample.pb.h"
+#include "packages/streamer/include/raw_sample.h"
 
 DEFINE_string(camera_addr, "tcp://*:5556", "ZMQ socket for camera publisher");
 DEFINE_string(camera_topic, "camera", "topic for camera publisher");
 DEFINE_int32(image_width, 640, "width of image to generate");
 DEFINE_int32(image_height, 360, "height of image to generate");
 DEFINE_string(format, "rgba", "image format to generate: rgba or luminance");
+DEFINE_bool(raw_payload, false, "send pixels in a separate frame so that the streamer can read them without copying. Subscribers other than the streamer must understand this format.");
 
 int main(int argc, char** argv) {
     gflags::SetUsageMessage("Publish frames over ZMQ");
@@ -30,7 +32,15 @@ int main(int argc, char** argv) {
 
     zmq::context_t context = zmq::context_t(1);
     LOG(INFO) << "publishing on " << FLAGS_camera_addr << ", topic:" << FLAGS_camera_topic;
-    net::ZMQProtobufPublisher<hal::CameraSample> pub(context, FLAGS_camera_addr, 1, 0);
+    std::unique_ptr<net::ZMQProtobufPublisher<hal::CameraSample> > pub;
+    zmq::socket_t rawPub(context, ZMQ_PUB);
+    if (FLAGS_raw_payload) {
+        rawPub.setsockopt(ZMQ_SNDHWM, 1);
+        rawPub.setsockopt(ZMQ_LINGER, 0);
+        rawPub.bind(FLAGS_camera_addr);
+    } else {
+        pub.reset(new net::ZMQProtobufPublisher<hal::CameraSample>(context, FLAGS_camera_addr, 1, 0));
+    }
 
     hal::CameraSample sample;
     sample.set_id(123);
@@ -68,8 +78,12 @@ int main(int argc, char** argv) {
         std::fill(buf.begin(), buf.end(), '\255');
         std::fill_n(buf.begin() + stride * row, stride, '\0');
 
-        sample.mutable_image()->set_data(buf.data(), buf.size());
-        pub.send(sample, FLAGS_camera_topic);
+        if (FLAGS_raw_payload) {
+            streamer::SendSample(rawPub, FLAGS_camera_topic, sample, buf.data(), buf.size());
+        } else {
+            sample.mutable_image()->set_data(buf.data(), buf.size());
+            pub->send(sample, FLAGS_camera_topic);
+        }
 
         row = (row + 1) % FLAGS_image_height;
         std::this_thread::sleep_for(std::chrono::milliseconds(30));
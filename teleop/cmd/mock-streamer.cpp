@@ -14,6 +14,7 @@
 #include "packages/net/include/zmq_protobuf.h"
 #include "packages/net/include/zmq_select.h"
 #include "packages/serialization/include/proto.h"
+#include "packages/streamer/include/raw_sample.h"
 #include "packages/streamer/proto/stream.pb.h"
 #include "packages/teleop/include/connection.h"
 #include "packages/teleop/include/context.h"
@@ -67,13 +68,13 @@ void publishTestPattern(zmq::socket_t* socket, const hal::Image& image, const st
     hal::CameraSample sample;
     sample.set_id(123);
     sample.mutable_image()->CopyFrom(image);
+    sample.mutable_image()->clear_data();
 
     std::vector<char> buf(image.data().size());
     for (int row = 0; true; row = (row + 1) % image.rows()) {
         std::copy_n(image.data().data(), image.data().size(), buf.begin());
         std::fill_n(buf.begin() + stride * row, stride, '\255');
-        sample.mutable_image()->set_data(buf.data(), buf.size());
-        net::send(*socket, sample, topic);
+        streamer::SendSample(*socket, topic, sample, buf.data(), buf.size());
         std::this_thread::sleep_for(std::chrono::milliseconds(30));
     }
 }
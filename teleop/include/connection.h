@@ -141,8 +141,9 @@ private:
     // Called by websocket client when a message is received
     void HandleMessage(websocketpp::connection_hdl h, client_t::message_ptr buf);
 
-    // Called when a video request arrives from the backend
-    void HandleVideoRequest(const VideoRequest& msg);
+    // Called when a video request arrives from the backend at the given time
+    // on the rtc::TimeMicros clock
+    void HandleVideoRequest(const VideoRequest& msg, int64_t received_us);
 
     // Send a manifest to the backend
     bool SendManifest(const Manifest& manifest);
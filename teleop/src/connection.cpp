@@ -16,6 +16,8 @@
 #include "websocketpp/common/thread.hpp"
 #include "websocketpp/config/asio_no_tls_client.hpp"
 
+#include "webrtc/base/timeutils.h"
+
 #include "packages/calibration/proto/system_calibration.pb.h"
 #include "packages/hal/proto/camera_sample.pb.h"
 #include "packages/serialization/include/proto.h"
@@ -163,6 +165,8 @@ void Connection::HandleClose(websocketpp::connection_hdl h) {
 }
 
 void Connection::HandleMessage(websocketpp::connection_hdl h, client_t::message_ptr buf) {
+    // Video requests are timed from here, before the message is parsed
+    const int64_t received_us = rtc::TimeMicros();
     BackendMessage msg;
     if (!msg.ParseFromString(buf->get_payload())) {
         LOG(WARNING) << "could not parse message";
@@ -191,7 +195,7 @@ void Connection::HandleMessage(websocketpp::connection_hdl h, client_t::message_
         reset_exposure_handler_(msg.reset_exposure());
     }
     if (msg.has_videorequest()) {
-        HandleVideoRequest(msg.videorequest());
+        HandleVideoRequest(msg.videorequest(), received_us);
     }
     if (msg.has_sdprequest()) {
         signaler_.HandleSDPRequest(msg.sdprequest());
@@ -199,6 +203,9 @@ void Connection::HandleMessage(websocketpp::connection_hdl h, client_t::message_
     if (msg.has_icecandidate()) {
         signaler_.HandleICECandidate(msg.icecandidate());
     }
+    if (msg.has_closeconnection()) {
+        signaler_.HandleCloseConnection(msg.closeconnection());
+    }
 
     // for now just acknowledge all commands immediately
     if (!msg.id().empty()) {
@@ -207,7 +214,7 @@ void Connection::HandleMessage(websocketpp::connection_hdl h, client_t::message_
     }
 }
 
-void Connection::HandleVideoRequest(const VideoRequest& msg) {
+void Connection::HandleVideoRequest(const VideoRequest& msg, int64_t received_us) {
     LOG(INFO) << "\n\nReceived video request for camera " << msg.camera() << "\n\n\n";
 
     if (opts_.video_sources().empty()) {
@@ -226,7 +233,18 @@ void Connection::HandleVideoRequest(const VideoRequest& msg) {
     video.mutable_source()->set_output_width(msg.width());
     video.mutable_source()->set_output_height(msg.height());
 
-    signaler_.HandleVideoRequest(msg.connection_id(), video.source());
+    // The backend can override the bitrate bounds for this connection
+    if (msg.min_bitrate_kbps() > 0) {
+        video.mutable_source()->set_min_bitrate_kbps(msg.min_bitrate_kbps());
+    }
+    if (msg.start_bitrate_kbps() > 0) {
+        video.mutable_source()->set_start_bitrate_kbps(msg.start_bitrate_kbps());
+    }
+    if (msg.max_bitrate_kbps() > 0) {
+        video.mutable_source()->set_max_bitrate_kbps(msg.max_bitrate_kbps());
+    }
+
+    signaler_.HandleVideoRequest(msg.connection_id(), video.source(), received_us);
 }
 
 std::error_code Connection::Dial() {